@@ -0,0 +1,395 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Monotonic arena for short-lived heap PIMPL wrappers.
+ *
+ *  A `monotonic_arena` hands out memory by bumping a pointer through
+ *  an optional initial buffer, followed by blocks from the global
+ *  `operator new`, and releases all of it at once when the arena is
+ *  released or destroyed. Individual deallocations are ignored.
+ *
+ *  `arena_allocator` allocates from an arena, and by default from
+ *  the arena installed for the calling thread by `arena_scope`, so
+ *  every member created while handling a request, including copies
+ *  made with a default-constructed allocator, comes from a single
+ *  arena which is freed at the end of the request. The allocator is
+ *  `is_trivially_releasable`, so the heap PIMPL deleters only run the
+ *  destructor of the implied member, without calling `deallocate`.
+ *
+ *  Every wrapper allocated from an arena **must** be destroyed before
+ *  the arena is released. An `arena_allocator` without an arena, for
+ *  example, default-constructed outside of any `arena_scope`, throws
+ *  `bad_alloc` on allocation, and over-aligned types are rejected at
+ *  compile time. The arena is not thread-safe, and should
+ *  only be used from the thread handling the request.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/arena_allocator.h>
+ *
+ *      using request_impl = unique_heap_pimpl<file_impl, arena_allocator<file_impl>>;
+ *
+ *      void handle_request()
+ *      {
+ *          char buffer[4096];
+ *          monotonic_arena arena(buffer, sizeof(buffer));
+ *          arena_scope scope(arena);
+ *          request_impl impl;          // allocated from `arena`
+ *      }
+ *
+ *  \synopsis
+ *      class monotonic_arena
+ *      {
+ *      public:
+ *          static constexpr size_t default_block_size = 4096;
+ *
+ *          explicit monotonic_arena(size_t block_size = default_block_size) noexcept;
+ *          monotonic_arena(void* buffer, size_t size, size_t block_size = default_block_size) noexcept;
+ *          monotonic_arena(const monotonic_arena&) = delete;
+ *          monotonic_arena& operator=(const monotonic_arena&) = delete;
+ *          ~monotonic_arena();
+ *
+ *          void* allocate(size_t bytes, size_t alignment = alignof(max_align_t));
+ *          void release() noexcept;
+ *
+ *          static monotonic_arena* current() noexcept;
+ *      };
+ *
+ *      class arena_scope
+ *      {
+ *      public:
+ *          arena_scope(monotonic_arena& arena) noexcept;
+ *          arena_scope(const arena_scope&) = delete;
+ *          arena_scope& operator=(const arena_scope&) = delete;
+ *          ~arena_scope();
+ *      };
+ *
+ *      template <typename T>
+ *      class arena_allocator
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using size_type = size_t;
+ *          using difference_type = ptrdiff_t;
+ *          using propagate_on_container_copy_assignment = true_type;
+ *          using propagate_on_container_move_assignment = true_type;
+ *          using propagate_on_container_swap = true_type;
+ *          using is_always_equal = false_type;
+ *
+ *          arena_allocator() noexcept;
+ *          arena_allocator(monotonic_arena& arena) noexcept;
+ *          template <typename U> arena_allocator(const arena_allocator<U>&) noexcept;
+ *
+ *          value_type* allocate(size_type n);
+ *          void deallocate(value_type* p, size_type n) noexcept;
+ *          monotonic_arena* arena() const noexcept;
+ *      };
+ *
+ *      template <typename T, typename U>
+ *      bool operator==(const arena_allocator<T>&, const arena_allocator<U>&) noexcept;
+ *
+ *      template <typename T, typename U>
+ *      bool operator!=(const arena_allocator<T>&, const arena_allocator<U>&) noexcept;
+ *
+ *      template <typename T>
+ *      struct is_trivially_releasable<arena_allocator<T>>;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/heap_pimpl.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/type_traits.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Bump allocator releasing every allocation at once.
+ */
+class monotonic_arena
+{
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t default_block_size = 4096;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    explicit
+    monotonic_arena(
+        size_t block_size = default_block_size
+    )
+    noexcept:
+        block_size_(block_size)
+    {}
+
+    monotonic_arena(
+        void* buffer,
+        size_t size,
+        size_t block_size = default_block_size
+    )
+    noexcept:
+        initial_(static_cast<char*>(buffer)),
+        initial_size_(size),
+        first_(initial_),
+        last_(initial_ + size),
+        block_size_(block_size)
+    {}
+
+    monotonic_arena(const monotonic_arena&) = delete;
+    monotonic_arena& operator=(const monotonic_arena&) = delete;
+
+    ~monotonic_arena()
+    {
+        release();
+    }
+
+    void*
+    allocate(
+        size_t bytes,
+        size_t alignment = alignof(max_align_t)
+    )
+    {
+        assert(alignment <= alignof(max_align_t) && "Arena alignment must not exceed the global operator new.");
+        char* p = align(first_, alignment);
+        if (p == nullptr || p > last_ || bytes > static_cast<size_t>(last_ - p)) {
+            p = grow(bytes);
+        }
+        first_ = p + bytes;
+        return p;
+    }
+
+    // Frees every block, and re-uses the initial buffer.
+    void
+    release()
+    noexcept
+    {
+        while (blocks_ != nullptr) {
+            block* prev = blocks_->prev;
+            ::operator delete(blocks_);
+            blocks_ = prev;
+        }
+        first_ = initial_;
+        last_ = initial_ + initial_size_;
+    }
+
+    static
+    monotonic_arena*
+    current()
+    noexcept
+    {
+        return local();
+    }
+
+private:
+    friend class arena_scope;
+
+    struct alignas(max_align_t) block
+    {
+        block* prev;
+    };
+
+    char* initial_ = nullptr;
+    size_t initial_size_ = 0;
+    char* first_ = nullptr;
+    char* last_ = nullptr;
+    block* blocks_ = nullptr;
+    size_t block_size_;
+
+    static
+    monotonic_arena*&
+    local()
+    noexcept
+    {
+        static thread_local monotonic_arena* arena = nullptr;
+        return arena;
+    }
+
+    static
+    char*
+    align(
+        char* p,
+        size_t alignment
+    )
+    noexcept
+    {
+        if (p == nullptr) {
+            return nullptr;
+        }
+        uintptr_t i = reinterpret_cast<uintptr_t>(p);
+        return p + ((alignment - i % alignment) % alignment);
+    }
+
+    // The header keeps the data aligned to `max_align_t`, and
+    // allocations larger than the block size get their own block.
+    char*
+    grow(
+        size_t bytes
+    )
+    {
+        size_t size = bytes > block_size_ ? bytes : block_size_;
+        if (size > size_t(-1) - sizeof(block)) {
+            throw bad_array_new_length();
+        }
+        block* b = static_cast<block*>(::operator new(sizeof(block) + size));
+        b->prev = blocks_;
+        blocks_ = b;
+        char* data = reinterpret_cast<char*>(b + 1);
+        last_ = data + size;
+        return data;
+    }
+};
+
+
+/**
+ *  \brief Install an arena as the default for the calling thread.
+ *
+ *  Scopes may be nested, and restore the previous arena on exit.
+ */
+class arena_scope
+{
+public:
+    arena_scope(
+        monotonic_arena& arena
+    )
+    noexcept:
+        prev_(monotonic_arena::local())
+    {
+        monotonic_arena::local() = &arena;
+    }
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    ~arena_scope()
+    {
+        monotonic_arena::local() = prev_;
+    }
+
+private:
+    monotonic_arena* prev_;
+};
+
+
+/**
+ *  \brief Allocator using a monotonic arena, ignoring deallocation.
+ */
+template <typename T>
+class arena_allocator
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using propagate_on_container_copy_assignment = true_type;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+    using is_always_equal = false_type;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    arena_allocator()
+    noexcept:
+        arena_(monotonic_arena::current())
+    {}
+
+    arena_allocator(
+        monotonic_arena& arena
+    )
+    noexcept:
+        arena_(&arena)
+    {}
+
+    arena_allocator(const arena_allocator&) noexcept = default;
+    arena_allocator& operator=(const arena_allocator&) noexcept = default;
+
+    template <typename U>
+    arena_allocator(
+        const arena_allocator<U>& x
+    )
+    noexcept:
+        arena_(x.arena())
+    {}
+
+    value_type*
+    allocate(
+        size_type n
+    )
+    {
+        static_assert(alignof(value_type) <= alignof(max_align_t), "Arena alignment must not exceed the global operator new.");
+        // memory from `operator new` would leak, since deallocation
+        // is ignored
+        if (arena_ == nullptr) {
+            throw bad_alloc();
+        }
+        if (n > size_type(-1) / sizeof(value_type)) {
+            throw bad_array_new_length();
+        }
+        return static_cast<value_type*>(arena_->allocate(n * sizeof(value_type), alignof(value_type)));
+    }
+
+    void
+    deallocate(
+        value_type*,
+        size_type
+    )
+    noexcept
+    {}
+
+    monotonic_arena*
+    arena()
+    const noexcept
+    {
+        return arena_;
+    }
+
+private:
+    monotonic_arena* arena_;
+};
+
+
+template <typename T, typename U>
+inline
+bool
+operator==(
+    const arena_allocator<T>& x,
+    const arena_allocator<U>& y
+)
+noexcept
+{
+    return x.arena() == y.arena();
+}
+
+
+template <typename T, typename U>
+inline
+bool
+operator!=(
+    const arena_allocator<T>& x,
+    const arena_allocator<U>& y
+)
+noexcept
+{
+    return !(x == y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T>
+struct is_trivially_releasable<arena_allocator<T>>: true_type
+{};
+
+template <typename T>
+struct is_relocatable<arena_allocator<T>>: true_type
+{};
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,444 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Singleton constructed asynchronously on first access.
+ *
+ *  For types whose constructor blocks, for example, loading a model
+ *  from disk, the `async_singleton` constructs the instance on an
+ *  executor rather than on the threads accessing it, so worker threads
+ *  keep running other tasks during a slow initialization. The first
+ *  call to `get_async` or `on_ready` submits the construction to the
+ *  executor, and later calls share the same construction.
+ *
+ *  `get_async` returns a `shared_future` to the instance, while
+ *  `on_ready` registers a callback, which is invoked with the ready
+ *  future on the executor thread once construction finishes, or
+ *  immediately on the calling thread if it already has. A callback
+ *  may, for example, resume a suspended coroutine or re-queue a task
+ *  on a thread pool. `get` blocks until the instance is ready, and
+ *  `try_get` returns the instance only if it is ready, without
+ *  submitting the construction.
+ *
+ *  The arguments are copied for the executor, and passed to the
+ *  constructor as rvalues. If construction throws, or the executor
+ *  throws while submitting it, the futures and callbacks of that
+ *  attempt receive the exception, and the next access submits a new
+ *  construction. The executor's exception is also rethrown to the
+ *  caller submitting the construction. `destroy` fails any callback
+ *  still pending with `broken_promise`, and a construction submitted
+ *  while `destroy` runs is discarded once complete, and its futures
+ *  also receive `broken_promise`.
+ *
+ *  The `Executor` is default-constructed for each submission, and
+ *  called with a `function<void()>`. The default `thread_executor`
+ *  runs it on a new detached thread.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/async_singleton.h>
+ *
+ *      struct model: async_singleton<model>
+ *      {
+ *          model(string path);
+ *      };
+ *
+ *      void handle(request r)
+ *      {
+ *          model::on_ready([r](const shared_future<model&>& f) {
+ *              pool.submit([r, f] { f.get().predict(r); });
+ *          }, "model.bin");
+ *      }
+ *
+ *  \synopsis
+ *      struct thread_executor
+ *      {
+ *          void operator()(function<void()> f) const;
+ *      };
+ *
+ *      template <typename T, typename Executor = thread_executor>
+ *      class async_singleton
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using future_type = shared_future<value_type&>;
+ *          using executor_type = Executor;
+ *
+ *          template <typename ... Ts>
+ *          static future_type get_async(Ts&&... ts);
+ *          template <typename Function, typename ... Ts>
+ *          static void on_ready(Function f, Ts&&... ts);
+ *          template <typename ... Ts>
+ *          static value_type& get(Ts&&... ts);
+ *          static value_type* try_get() noexcept;
+ *          static void destroy();
+ *
+ *      protected:
+ *          async_singleton() = default;
+ *          async_singleton(const async_singleton&) = delete;
+ *          async_singleton& operator=(const async_singleton&) = delete;
+ *          ~async_singleton();
+ *      };
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/chrono.h>
+#include <pycpp/stl/exception.h>
+#include <pycpp/stl/functional.h>
+#include <pycpp/stl/future.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/thread.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+#include <pycpp/stl/vector.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Executor running each task on a new detached thread.
+ */
+struct thread_executor
+{
+    void
+    operator()(
+        function<void()> f
+    )
+    const
+    {
+        thread(move(f)).detach();
+    }
+};
+
+
+/**
+ *  \brief Thread-safe heap singleton constructed on an executor.
+ */
+template <typename T, typename Executor = thread_executor>
+class async_singleton
+{
+public:
+    using value_type = T;
+    using future_type = shared_future<value_type&>;
+    using executor_type = Executor;
+
+    template <typename ... Ts>
+    static
+    future_type
+    get_async(
+        Ts&&... ts
+    )
+    {
+        future_type future;
+        pending task;
+        {
+            lock_guard<mutex> lock(mu_);
+            task = start(future, forward<Ts>(ts)...);
+        }
+        submit(task);
+        return future;
+    }
+
+    // Call `f` with the ready future, once construction finishes.
+    template <typename Function, typename ... Ts>
+    static
+    void
+    on_ready(
+        Function f,
+        Ts&&... ts
+    )
+    {
+        future_type future;
+        pending task;
+        bool waiting;
+        {
+            lock_guard<mutex> lock(mu_);
+            task = start(future, forward<Ts>(ts)...);
+            waiting = !ready(future);
+            if (waiting) {
+                callbacks_.emplace_back(move(f));
+            }
+        }
+        submit(task);
+        if (!waiting) {
+            f(future);
+        }
+    }
+
+    template <typename ... Ts>
+    static
+    value_type&
+    get(
+        Ts&&... ts
+    )
+    {
+        T* p = data_.load(memory_order_acquire);
+        if (p == nullptr) {
+            return get_async(forward<Ts>(ts)...).get();
+        }
+        return *p;
+    }
+
+    static
+    value_type*
+    try_get()
+    noexcept
+    {
+        return data_.load(memory_order_acquire);
+    }
+
+    // Wait for any pending construction, and destroy the instance.
+    static
+    void
+    destroy()
+    {
+        future_type future;
+        {
+            lock_guard<mutex> lock(mu_);
+            future = future_;
+        }
+        if (future.valid()) {
+            future.wait();
+        }
+
+        vector<callback> callbacks;
+        {
+            lock_guard<mutex> lock(mu_);
+            // use temporary to avoid recursion
+            value_type* tmp = data_.exchange(nullptr, memory_order_acq_rel);
+            future_ = future_type();
+            // a construction still running its callbacks must not
+            // hand over the callbacks of the next construction
+            ++generation_;
+            callbacks.swap(callbacks_);
+            if (tmp != nullptr) {
+                managed_ = true;
+                delete tmp;
+                managed_ = false;
+            }
+        }
+
+        if (!callbacks.empty()) {
+            promise_type p;
+            p.set_exception(make_exception_ptr(future_error(future_errc::broken_promise)));
+            future_type broken = p.get_future().share();
+            for (callback& f: callbacks) {
+                f(broken);
+            }
+        }
+    }
+
+protected:
+    async_singleton() = default;
+    async_singleton(const async_singleton&) = delete;
+    async_singleton& operator=(const async_singleton&) = delete;
+
+    ~async_singleton()
+    {
+#ifndef NDEBUG
+        assert(managed_ && "Singleton used outside of pattern.");
+#endif
+    }
+
+private:
+    using callback = function<void(const future_type&)>;
+    using promise_type = promise<value_type&>;
+
+    static atomic<value_type*> data_;
+    static mutex mu_;
+    // the current construction, invalid until submitted, the
+    // callbacks waiting for it, and the number of constructions
+    // submitted, guarded by `mu_`
+    static future_type future_;
+    static vector<callback> callbacks_;
+    static size_t generation_;
+    // whether the pattern is constructing or destroying an instance
+    // on the calling thread, since a stale construction may destroy
+    // its instance while the next one is constructed
+    static thread_local bool managed_;
+
+    // Construction to submit, with its promise, so a failure to
+    // submit it can be reported.
+    struct pending
+    {
+        function<void()> task;
+        shared_ptr<promise_type> promise;
+        size_t generation = 0;
+    };
+
+    static
+    bool
+    ready(
+        const future_type& future
+    )
+    {
+        return future.wait_for(chrono::seconds(0)) == future_status::ready;
+    }
+
+    // Get the current construction, and the task to submit if none
+    // is pending. Must hold `mu_`.
+    template <typename ... Ts>
+    static
+    pending
+    start(
+        future_type& future,
+        Ts&&... ts
+    )
+    {
+        pending task;
+        if (!future_.valid()) {
+            task.promise = make_shared<promise_type>();
+            task.generation = ++generation_;
+            future_ = task.promise->get_future().share();
+            task.task = bind(&build<decay_t<Ts>...>, task.promise, task.generation, forward<Ts>(ts)...);
+        }
+        future = future_;
+        return task;
+    }
+
+    // Submitted without holding `mu_`, so the executor may run the
+    // task inline.
+    static
+    void
+    submit(
+        pending& task
+    )
+    {
+        if (!task.task) {
+            return;
+        }
+        try {
+            executor_type executor;
+            executor(move(task.task));
+        } catch (...) {
+            fail(task, current_exception());
+            throw;
+        }
+    }
+
+    // Report a failure to submit the construction, so the next
+    // access submits a new one.
+    static
+    void
+    fail(
+        pending& task,
+        exception_ptr error
+    )
+    {
+        try {
+            task.promise->set_exception(error);
+        } catch (const future_error&) {
+            // the executor ran the task before throwing
+            return;
+        }
+        complete(task.generation, true);
+    }
+    template <typename ... Us>
+    static
+    void
+    build(
+        const shared_ptr<promise_type>& p,
+        size_t generation,
+        Us&... us
+    )
+    {
+        T* instance = nullptr;
+        bool failed = false;
+        try {
+            managed_ = true;
+            instance = new T(move(us)...);
+            managed_ = false;
+        } catch (...) {
+            managed_ = false;
+            failed = true;
+            p->set_exception(current_exception());
+        }
+
+        if (instance != nullptr && !publish(p, generation, instance)) {
+            // `destroy` ran during the construction, so the instance
+            // must not replace the next one
+            managed_ = true;
+            delete instance;
+            managed_ = false;
+            p->set_exception(make_exception_ptr(future_error(future_errc::broken_promise)));
+            return;
+        }
+        complete(generation, failed);
+    }
+
+    // Publish the instance, unless the construction is stale.
+    static
+    bool
+    publish(
+        const shared_ptr<promise_type>& p,
+        size_t generation,
+        T* instance
+    )
+    {
+        lock_guard<mutex> lock(mu_);
+        if (generation != generation_) {
+            return false;
+        }
+        data_.store(instance, memory_order_release);
+        p->set_value(*instance);
+        return true;
+    }
+
+    // Run the callbacks of the construction, unless it is stale.
+    static
+    void
+    complete(
+        size_t generation,
+        bool failed
+    )
+    {
+        future_type future;
+        vector<callback> callbacks;
+        {
+            lock_guard<mutex> lock(mu_);
+            if (generation != generation_) {
+                return;
+            }
+            future = future_;
+            callbacks.swap(callbacks_);
+            if (failed) {
+                future_ = future_type();
+            }
+        }
+        for (callback& f: callbacks) {
+            f(future);
+        }
+    }
+};
+
+template <typename T, typename Executor>
+atomic<T*>
+async_singleton<T, Executor>::data_ = ATOMIC_VAR_INIT(nullptr);
+
+template <typename T, typename Executor>
+mutex
+async_singleton<T, Executor>::mu_;
+
+template <typename T, typename Executor>
+shared_future<T&>
+async_singleton<T, Executor>::future_;
+
+template <typename T, typename Executor>
+vector<function<void(const shared_future<T&>&)>>
+async_singleton<T, Executor>::callbacks_;
+
+template <typename T, typename Executor>
+size_t
+async_singleton<T, Executor>::generation_ = 0;
+
+template <typename T, typename Executor>
+thread_local bool
+async_singleton<T, Executor>::managed_ = false;
+
+PYCPP_END_NAMESPACE
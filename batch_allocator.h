@@ -0,0 +1,302 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Batched construction of heap PIMPL wrappers.
+ *
+ *  Allocator handing out single objects from a contiguous block
+ *  reserved up-front, which places objects allocated together
+ *  adjacently in memory for cache locality during iteration. Each
+ *  wrapper still owns and destroys its own member, while the block
+ *  is released once every copy of the allocator, including the
+ *  copies held by the wrappers, is destroyed.
+ *
+ *  Memory for members destroyed before the block is released is
+ *  not reused. Once the block is exhausted, or for copies of the
+ *  wrapper made with a default-constructed allocator, objects are
+ *  allocated individually from the underlying allocator.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/batch_allocator.h>
+ *
+ *      // allocate 100000 adjacent members with a single allocation
+ *      auto impls = make_heap_pimpl_array<file_impl>(100000);
+ *
+ *  \synopsis
+ *      template <typename T, typename Allocator = allocator<T>>
+ *      class batch_allocator
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using size_type = size_t;
+ *          using difference_type = ptrdiff_t;
+ *          using upstream_type = Allocator;
+ *          using propagate_on_container_copy_assignment = true_type;
+ *          using propagate_on_container_move_assignment = true_type;
+ *          using propagate_on_container_swap = true_type;
+ *          using is_always_equal = false_type;
+ *
+ *          batch_allocator() noexcept;
+ *          explicit batch_allocator(size_type n, const upstream_type& alloc = upstream_type());
+ *          batch_allocator(const batch_allocator&) noexcept;
+ *          template <typename U> batch_allocator(const batch_allocator<U, Allocator>&) noexcept;
+ *          batch_allocator& operator=(const batch_allocator&) noexcept;
+ *          ~batch_allocator();
+ *
+ *          value_type* allocate(size_type n);
+ *          void deallocate(value_type* p, size_type n) noexcept;
+ *          upstream_type upstream() const noexcept;
+ *
+ *          bool operator==(const batch_allocator&) const noexcept;
+ *          bool operator!=(const batch_allocator&) const noexcept;
+ *      };
+ *
+ *      template <typename T, typename Allocator = allocator<T>>
+ *      vector<unique_heap_pimpl<T, batch_allocator<T, Allocator>>>
+ *      make_heap_pimpl_array(size_t n, const Allocator& alloc = Allocator());
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/heap_pimpl.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/vector.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace batch_detail
+{
+// DETAIL
+// ------
+
+template <typename T, typename Allocator>
+struct batch_block
+{
+    using traits_type = allocator_traits<Allocator>;
+
+    Allocator alloc;
+    T* first;
+    size_t size;
+    atomic<size_t> next;
+    atomic<size_t> refs;
+
+    batch_block(
+        size_t n,
+        const Allocator& a
+    ):
+        alloc(a),
+        first(traits_type::allocate(alloc, n)),
+        size(n),
+        next(0),
+        refs(1)
+    {}
+
+    ~batch_block()
+    {
+        traits_type::deallocate(alloc, first, size);
+    }
+
+    bool
+    owns(
+        const T* p
+    )
+    const noexcept
+    {
+        return p >= first && p < first + size;
+    }
+};
+
+}   /* batch_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Allocator serving single objects from a shared contiguous block.
+ */
+template <typename T, typename Allocator = allocator<T>>
+class batch_allocator
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using upstream_type = typename allocator_traits<Allocator>::template rebind_alloc<T>;
+    using propagate_on_container_copy_assignment = true_type;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+    using is_always_equal = false_type;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = batch_allocator<U, Allocator>;
+    };
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    batch_allocator() noexcept = default;
+
+    explicit
+    batch_allocator(
+        size_type n,
+        const upstream_type& alloc = upstream_type()
+    ):
+        upstream_(alloc)
+    {
+        block_allocator a(alloc);
+        block_ = block_traits::allocate(a, 1);
+        try {
+            block_traits::construct(a, block_, n, alloc);
+        } catch (...) {
+            block_traits::deallocate(a, block_, 1);
+            throw;
+        }
+    }
+
+    batch_allocator(
+        const batch_allocator& x
+    )
+    noexcept:
+        upstream_(x.upstream_),
+        block_(x.block_)
+    {
+        if (block_ != nullptr) {
+            block_->refs.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    // Blocks are typed, so rebound allocators allocate individually.
+    template <typename U>
+    batch_allocator(
+        const batch_allocator<U, Allocator>& x
+    )
+    noexcept:
+        upstream_(x.upstream())
+    {}
+
+    batch_allocator&
+    operator=(
+        const batch_allocator& x
+    )
+    noexcept
+    {
+        if (this != &x) {
+            batch_allocator tmp(x);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    ~batch_allocator()
+    {
+        if (block_ != nullptr && block_->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            block_allocator a(upstream_);
+            block_traits::destroy(a, block_);
+            block_traits::deallocate(a, block_, 1);
+        }
+    }
+
+    value_type*
+    allocate(
+        size_type n
+    )
+    {
+        if (n == 1 && block_ != nullptr) {
+            size_t i = block_->next.fetch_add(1, memory_order_relaxed);
+            if (i < block_->size) {
+                return block_->first + i;
+            }
+        }
+        return upstream_traits::allocate(upstream_, n);
+    }
+
+    void
+    deallocate(
+        value_type* p,
+        size_type n
+    )
+    noexcept
+    {
+        // memory in the block is released with the block
+        if (block_ == nullptr || !block_->owns(p)) {
+            upstream_traits::deallocate(upstream_, p, n);
+        }
+    }
+
+    upstream_type
+    upstream()
+    const noexcept
+    {
+        return upstream_;
+    }
+
+    bool
+    operator==(
+        const batch_allocator& x
+    )
+    const noexcept
+    {
+        return block_ == x.block_ && upstream_ == x.upstream_;
+    }
+
+    bool
+    operator!=(
+        const batch_allocator& x
+    )
+    const noexcept
+    {
+        return !operator==(x);
+    }
+
+private:
+    using upstream_traits = allocator_traits<upstream_type>;
+    using block_type = batch_detail::batch_block<T, upstream_type>;
+    using block_allocator = typename upstream_traits::template rebind_alloc<block_type>;
+    using block_traits = allocator_traits<block_allocator>;
+
+    upstream_type upstream_;
+    block_type* block_ = nullptr;
+
+    void
+    swap(
+        batch_allocator& x
+    )
+    noexcept
+    {
+        fast_swap(upstream_, x.upstream_);
+        fast_swap(block_, x.block_);
+    }
+};
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Default-construct `n` heap PIMPL wrappers from a single contiguous block.
+ */
+template <typename T, typename Allocator = allocator<T>>
+vector<unique_heap_pimpl<T, batch_allocator<T, Allocator>>>
+make_heap_pimpl_array(
+    size_t n,
+    const Allocator& alloc = Allocator()
+)
+{
+    using allocator_type = batch_allocator<T, Allocator>;
+    using pimpl_type = unique_heap_pimpl<T, allocator_type>;
+
+    allocator_type a(n, alloc);
+    vector<pimpl_type> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        v.emplace_back(a);
+    }
+    return v;
+}
+
+PYCPP_END_NAMESPACE
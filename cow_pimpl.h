@@ -0,0 +1,308 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Copy-on-write PIMPL idiom.
+ *
+ *  PIMPL idiom with value semantics, which shares the implied member
+ *  on copy like `shared_heap_pimpl`, and only copies the implied
+ *  member on the first non-const access while it is shared. This
+ *  avoids the deep copies of `unique_heap_pimpl` for members that
+ *  are copied often but rarely modified.
+ *
+ *  Const access never copies the member, so the public class should
+ *  use the const overloads for read-only operations. Copies detached
+ *  from a shared member use the default allocator.
+ *
+ *  Non-const access returns a reference into storage owned by this
+ *  wrapper alone, which may be kept and written through later. So
+ *  that such writes never reach a copy, non-const access marks the
+ *  storage unshareable, like the copy-on-write `std::string` did, and
+ *  copies of the wrapper then copy the member eagerly. The storage
+ *  becomes shareable again once it is replaced, by assignment from
+ *  another wrapper or of a value while shared.
+ *
+ *  Like `shared_ptr`, distinct wrappers sharing a member may be used
+ *  from different threads, but the same wrapper may not be modified
+ *  concurrently.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/cow_pimpl.h>
+ *
+ *      struct file_impl;
+ *      struct file
+ *      {
+ *      public:
+ *      private:
+ *          cow_pimpl<file_impl> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      template <typename T>
+ *      class cow_pimpl
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *          using storage_type = shared_heap_pimpl<value_type>;
+ *
+ *          cow_pimpl();
+ *
+ *          template <typename Allocator>
+ *          cow_pimpl(const Allocator& alloc);
+ *
+ *          cow_pimpl(const cow_pimpl& x);
+ *          cow_pimpl(const value_type& x);
+ *          cow_pimpl(cow_pimpl&& x) noexcept = default;
+ *          cow_pimpl(value_type&& x);
+ *          cow_pimpl& operator=(const cow_pimpl& x);
+ *          cow_pimpl& operator=(cow_pimpl&& x) noexcept = default;
+ *          cow_pimpl& operator=(const value_type& x);
+ *          cow_pimpl& operator=(value_type&& x);
+ *
+ *          reference operator*();
+ *          const_reference operator*() const noexcept;
+ *          pointer operator->();
+ *          const_pointer operator->() const noexcept;
+ *          operator reference();
+ *          operator const_reference() const noexcept;
+ *          reference get();
+ *          const_reference get() const noexcept;
+ *          long use_count() const noexcept;
+ *
+ *          void detach();
+ *          void swap(cow_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename T>
+ *      void swap(cow_pimpl<T>& x, cow_pimpl<T>& y) noexcept;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/heap_pimpl.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief PIMPL idiom with shared storage and copy-on-write semantics.
+ */
+template <typename T>
+class cow_pimpl
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using storage_type = shared_heap_pimpl<value_type>;
+
+    // Constructors
+    cow_pimpl() = default;
+
+    template <typename Allocator>
+    cow_pimpl(
+        const Allocator& alloc
+    ):
+        ptr_(alloc)
+    {}
+
+    // Copy constructors
+    cow_pimpl(
+        const cow_pimpl& x
+    ):
+        ptr_(share(x))
+    {}
+
+    cow_pimpl(
+        const value_type& x
+    ):
+        ptr_(x)
+    {}
+
+    // Move constructors
+    cow_pimpl(cow_pimpl&& x) noexcept = default;
+
+    cow_pimpl(
+        value_type&& x
+    ):
+        ptr_(move(x))
+    {}
+
+    // Assignment
+    cow_pimpl&
+    operator=(
+        const cow_pimpl& x
+    )
+    {
+        if (this != &x) {
+            ptr_ = share(x);
+            shareable_ = true;
+        }
+        return *this;
+    }
+
+    cow_pimpl& operator=(cow_pimpl&& x) noexcept = default;
+
+    cow_pimpl&
+    operator=(
+        const value_type& x
+    )
+    {
+        // replace a shared member rather than copying it first,
+        // and a moved-from wrapper has no member to assign to
+        if (use_count() != 1) {
+            ptr_ = storage_type(x);
+            shareable_ = true;
+        } else {
+            ptr_.get() = x;
+        }
+        return *this;
+    }
+
+    cow_pimpl&
+    operator=(
+        value_type&& x
+    )
+    {
+        if (use_count() != 1) {
+            ptr_ = storage_type(move(x));
+            shareable_ = true;
+        } else {
+            ptr_.get() = move(x);
+        }
+        return *this;
+    }
+
+    // Observers
+    reference
+    operator*()
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const noexcept
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const noexcept
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const noexcept
+    {
+        return get();
+    }
+
+    reference
+    get()
+    {
+        detach();
+        shareable_ = false;
+        return ptr_.get();
+    }
+
+    const_reference
+    get()
+    const noexcept
+    {
+        return ptr_.get();
+    }
+
+    long
+    use_count()
+    const noexcept
+    {
+        return ptr_.use_count();
+    }
+
+    // Modifiers
+    void
+    detach()
+    {
+        if (use_count() > 1) {
+            const_reference x = ptr_.get();
+            ptr_ = storage_type(x);
+        }
+    }
+
+    void
+    swap(
+        cow_pimpl& x
+    )
+    noexcept
+    {
+        ptr_.swap(x.ptr_);
+        bool shareable = shareable_;
+        shareable_ = x.shareable_;
+        x.shareable_ = shareable;
+    }
+
+private:
+    storage_type ptr_;
+    // false once a mutable reference to the storage was handed out
+    bool shareable_ = true;
+
+    // Share the storage of `x`, or copy the member if it is unshareable.
+    static
+    storage_type
+    share(
+        const cow_pimpl& x
+    )
+    {
+        if (x.shareable_ || !x.ptr_) {
+            return x.ptr_;
+        }
+        return storage_type(x.ptr_.get());
+    }
+};
+
+template <typename T>
+void
+swap(
+    cow_pimpl<T>& x,
+    cow_pimpl<T>& y
+)
+noexcept
+{
+    return x.swap(y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T>
+struct is_relocatable<cow_pimpl<T>>: true_type
+{};
+
+PYCPP_END_NAMESPACE
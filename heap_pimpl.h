@@ -23,6 +23,31 @@
  *  Providing an empty allocator makes these classes as efficient
  *  as the underlying smart pointers.
  *
+ *  Moving a `unique_heap_pimpl` transfers ownership of the pointer,
+ *  without allocating or moving the implied member. The moved-from
+ *  wrapper holds no value, and may only be assigned to, swapped
+ *  or destroyed. Move assignment propagates the allocator according
+ *  to `propagate_on_container_move_assignment`, and only falls back
+ *  to moving the implied member when the allocators are unequal.
+ *
+ *  For allocators which are `is_trivially_releasable`, such as the
+ *  `arena_allocator` of a monotonic arena, the wrappers only destroy
+ *  the implied member, and never return the memory to the allocator.
+ *
+ *  A `weak_heap_pimpl` observes a `shared_heap_pimpl` without owning
+ *  it, for example, from a cache, and `lock` returns an owning wrapper
+ *  while the implied member is alive, or an empty one once every owner
+ *  released it. The aliasing constructors share the ownership of a
+ *  wrapper, while referring to a sub-object of its implied member,
+ *  without copying the sub-object. Both only share the control block
+ *  of the owner, so the implied member and its control block remain
+ *  a single allocation. The implied member is destroyed when the last
+ *  owner is released, however, the allocation itself is only returned
+ *  once the last `weak_heap_pimpl` is also released.
+ *
+ *  When `USE_PIMPL_INSTRUMENTATION` is defined, both wrappers record
+ *  their allocations, copies and moves, see `pimpl_instrumentation.h`.
+ *
  *  The class should be used as a private member variable encapsulating
  *  the implied class in the public class. For example:
  *
@@ -61,13 +86,13 @@
  *          unique_heap_pimpl(const value_type& x);
  *          unique_heap_pimpl(const value_type& x, const allocator_type& alloc);
  *          unique_heap_pimpl(unique_heap_pimpl&& x) noexcept;
- *          unique_heap_pimpl(unique_heap_pimpl&& x, const allocator_type& alloc) noexcept;
- *          unique_heap_pimpl(value_type&& x) noexcept;
- *          unique_heap_pimpl(value_type&& x, const allocator_type& alloc) noexcept;
+ *          unique_heap_pimpl(unique_heap_pimpl&& x, const allocator_type& alloc) noexcept(see below);
+ *          unique_heap_pimpl(value_type&& x);
+ *          unique_heap_pimpl(value_type&& x, const allocator_type& alloc);
  *          unique_heap_pimpl& operator=(const unique_heap_pimpl& x);
  *          unique_heap_pimpl& operator=(const value_type& x);
- *          unique_heap_pimpl& operator=(unique_heap_pimpl&& x) noexcept;
- *          unique_heap_pimpl& operator=(value_type&& x) noexcept;
+ *          unique_heap_pimpl& operator=(unique_heap_pimpl&& x) noexcept(see below);
+ *          unique_heap_pimpl& operator=(value_type&& x);
  *
  *          reference operator*() noexcept;
  *          const_reference operator*() const noexcept;
@@ -77,6 +102,7 @@
  *          operator const_reference() const noexcept;
  *          reference get() noexcept;
  *          const_reference get() const noexcept;
+ *          allocator_type get_allocator() const noexcept;
  *
  *          void swap(unique_heap_pimpl& x) noexcept;
  *      };
@@ -113,6 +139,12 @@
  *          template <typename Allocator>
  *          shared_heap_pimpl(value_type&& x, const Allocator& alloc) noexcept;
  *
+ *          template <typename U>
+ *          shared_heap_pimpl(const shared_heap_pimpl<U>& owner, pointer p) noexcept;
+ *
+ *          template <typename U>
+ *          shared_heap_pimpl(shared_heap_pimpl<U>&& owner, pointer p) noexcept;
+ *
  *          shared_heap_pimpl& operator=(const shared_heap_pimpl&) = default;
  *          shared_heap_pimpl& operator=(shared_heap_pimpl&& x) noexcept = default;
  *          shared_heap_pimpl& operator=(const value_type& x);
@@ -126,16 +158,69 @@
  *          operator const_reference() const noexcept;
  *          reference get() noexcept;
  *          const_reference get() const noexcept;
+ *          long use_count() const noexcept;
+ *          explicit operator bool() const noexcept;
+ *
+ *          template <typename U>
+ *          bool owner_before(const shared_heap_pimpl<U>& x) const noexcept;
+ *          template <typename U>
+ *          bool owner_before(const weak_heap_pimpl<U>& x) const noexcept;
  *
  *          void swap(shared_heap_pimpl& x) noexcept;
  *      };
  *
  *      template <typename T>
  *      void swap(shared_heap_pimpl<T>& x, shared_heap_pimpl<T>& y);
+ *
+ *
+ *      template <typename T>
+ *      class weak_heap_pimpl
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using storage_type = weak_ptr<value_type>;
+ *
+ *          weak_heap_pimpl() noexcept = default;
+ *          weak_heap_pimpl(const shared_heap_pimpl<T>& x) noexcept;
+ *          weak_heap_pimpl(const weak_heap_pimpl& x) noexcept = default;
+ *          weak_heap_pimpl(weak_heap_pimpl&& x) noexcept = default;
+ *          weak_heap_pimpl& operator=(const shared_heap_pimpl<T>& x) noexcept;
+ *          weak_heap_pimpl& operator=(const weak_heap_pimpl& x) noexcept = default;
+ *          weak_heap_pimpl& operator=(weak_heap_pimpl&& x) noexcept = default;
+ *
+ *          shared_heap_pimpl<T> lock() const noexcept;
+ *          bool expired() const noexcept;
+ *          long use_count() const noexcept;
+ *
+ *          template <typename U>
+ *          bool owner_before(const shared_heap_pimpl<U>& x) const noexcept;
+ *          template <typename U>
+ *          bool owner_before(const weak_heap_pimpl<U>& x) const noexcept;
+ *
+ *          void reset() noexcept;
+ *          void swap(weak_heap_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename T>
+ *      void swap(weak_heap_pimpl<T>& x, weak_heap_pimpl<T>& y);
+ *
+ *      template <typename Allocator>
+ *      struct is_trivially_releasable;
+ *
+ *      template <typename T, typename Allocator>
+ *      struct is_relocatable<unique_heap_pimpl<T, Allocator>>;
+ *
+ *      template <typename T>
+ *      struct is_relocatable<shared_heap_pimpl<T>>;
+ *
+ *      template <typename T>
+ *      struct is_relocatable<weak_heap_pimpl<T>>;
  */
 
 #pragma once
 
+#include <pycpp/adaptor/pimpl_instrumentation.h>
+#include <pycpp/adaptor/relocate.h>
 #include <pycpp/stl/cassert.h>
 #include <pycpp/stl/cstddef.h>
 #include <pycpp/stl/memory.h>
@@ -153,45 +238,182 @@ class unique_heap_pimpl;
 template <typename T>
 class shared_heap_pimpl;
 
+template <typename T>
+class weak_heap_pimpl;
+
+// TRAITS
+// ------
+
+/**
+ *  \brief Whether deallocating from the allocator is a no-op.
+ *
+ *  Specialize for allocators which release their memory all at
+ *  once, such as monotonic arenas, so the heap PIMPL wrappers only
+ *  destroy the implied member, and never call `deallocate`.
+ */
+template <typename Allocator>
+struct is_trivially_releasable: false_type
+{};
+
+namespace heap_detail
+{
+// DETAIL
+// ------
+
+// Destroys the object without returning the memory to the allocator.
+template <typename Allocator>
+class release_destructor
+{
+public:
+    using traits_type = allocator_traits<Allocator>;
+    using pointer = typename traits_type::pointer;
+
+    release_destructor(
+        const Allocator& alloc
+    )
+    noexcept:
+        alloc_(alloc)
+    {}
+
+    void
+    operator()(
+        pointer p
+    )
+    noexcept
+    {
+        traits_type::destroy(alloc_, p);
+    }
+
+    Allocator&
+    get_allocator()
+    noexcept
+    {
+        return alloc_;
+    }
+
+    const Allocator&
+    get_allocator()
+    const noexcept
+    {
+        return alloc_;
+    }
+
+private:
+    Allocator alloc_;
+};
+
+
+template <typename Allocator>
+using base_deleter = typename conditional<
+        is_trivially_releasable<Allocator>::value,
+        release_destructor<Allocator>,
+        allocator_destructor<Allocator, 1>
+    >::type;
+
+#if defined(USE_PIMPL_INSTRUMENTATION)
+
+template <typename T, typename Allocator>
+struct heap_pimpl_deleter: base_deleter<Allocator>
+{
+    using base = base_deleter<Allocator>;
+    using base::base;
+
+    template <typename Pointer>
+    void
+    operator()(
+        Pointer p
+    )
+    noexcept
+    {
+        pimpl_record_deallocation<T>();
+        base::operator()(p);
+    }
+};
+
+#else                                           // !USE_PIMPL_INSTRUMENTATION
+
+template <typename T, typename Allocator>
+using heap_pimpl_deleter = base_deleter<Allocator>;
+
+#endif                                          // USE_PIMPL_INSTRUMENTATION
+
+}   /* heap_detail */
+
 namespace
 {
 // HELPERS
 // -------
 
+// The deleter is only attached once the member is constructed, so a
+// throwing constructor never destroys the unconstructed member, or
+// records a deallocation without an allocation.
+
 template <typename T, typename Allocator, typename ... Ts>
-unique_ptr<T, allocator_destructor<Allocator, 1>>
-make_heap_pimpl(
+unique_ptr<T, heap_detail::heap_pimpl_deleter<T, Allocator>>
+allocate_heap_pimpl(
+    const Allocator& alloc,
     Ts&&... ts
 )
 {
-    using deleter_type = allocator_destructor<Allocator, 1>;
+    using deleter_type = heap_detail::heap_pimpl_deleter<T, Allocator>;
     using traits_type = allocator_traits<Allocator>;
     using storage_type = unique_ptr<T, deleter_type>;
 
-    Allocator a;
-    auto ptr = storage_type(traits_type::allocate(a, 1), deleter_type(a));
-    traits_type::construct(a, ptr.get(), forward<Ts>(ts)...);
+    Allocator a(alloc);
+    T* p = traits_type::allocate(a, 1);
+    try {
+        traits_type::construct(a, p, forward<Ts>(ts)...);
+    } catch (...) {
+        traits_type::deallocate(a, p, 1);
+        throw;
+    }
+    pimpl_record_allocation<T>(sizeof(T));
 
-    return ptr;
+    return storage_type(p, deleter_type(a));
 }
 
 
 template <typename T, typename Allocator, typename ... Ts>
-unique_ptr<T, allocator_destructor<Allocator, 1>>
-allocate_heap_pimpl(
+unique_ptr<T, heap_detail::heap_pimpl_deleter<T, Allocator>>
+make_heap_pimpl(
+    Ts&&... ts
+)
+{
+    return allocate_heap_pimpl<T>(Allocator(), forward<Ts>(ts)...);
+}
+
+
+// With instrumentation, the control block is allocated through
+// a counting allocator, which records the deallocation once the
+// last owner releases the implied member.
+
+template <typename T, typename Allocator, typename ... Ts>
+shared_ptr<T>
+allocate_shared_pimpl(
     const Allocator& alloc,
     Ts&&... ts
 )
 {
-    using deleter_type = allocator_destructor<Allocator, 1>;
-    using traits_type = allocator_traits<Allocator>;
-    using storage_type = unique_ptr<T, deleter_type>;
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    using allocator_type = instrument_detail::counting_allocator<T, T, Allocator>;
+    return PYCPP_NAMESPACE::allocate_shared<T>(allocator_type(alloc), forward<Ts>(ts)...);
+#else
+    return PYCPP_NAMESPACE::allocate_shared<T>(alloc, forward<Ts>(ts)...);
+#endif
+}
 
-    Allocator a(alloc);
-    auto ptr = storage_type(traits_type::allocate(a, 1), deleter_type(a));
-    traits_type::construct(a, ptr.get(), forward<Ts>(ts)...);
 
-    return ptr;
+template <typename T, typename ... Ts>
+shared_ptr<T>
+make_shared_pimpl(
+    Ts&&... ts
+)
+{
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    return allocate_shared_pimpl<T>(allocator<T>(), forward<Ts>(ts)...);
+#else
+    return PYCPP_NAMESPACE::make_shared<T>(forward<Ts>(ts)...);
+#endif
 }
 
 }   /* anonymous */
@@ -217,7 +439,7 @@ public:
     using const_pointer = const T*;
     using allocator_type = Allocator;
     using traits_type = allocator_traits<allocator_type>;
-    using deleter_type = allocator_destructor<Allocator, 1>;
+    using deleter_type = heap_detail::heap_pimpl_deleter<T, Allocator>;
     using storage_type = unique_ptr<value_type, deleter_type>;
 
     // MEMBER FUNCTIONS
@@ -238,14 +460,18 @@ public:
         const unique_heap_pimpl& x
     ):
         ptr_(make_heap_pimpl<value_type, allocator_type>(x.get()))
-    {}
+    {
+        pimpl_record_copy<value_type>();
+    }
 
     unique_heap_pimpl(
         const unique_heap_pimpl& x,
         const allocator_type& alloc
     ):
         ptr_(allocate_heap_pimpl<value_type>(alloc, x.get()))
-    {}
+    {
+        pimpl_record_copy<value_type>();
+    }
 
     unique_heap_pimpl(
         const value_type& x
@@ -265,29 +491,31 @@ public:
         unique_heap_pimpl&& x
     )
     noexcept:
-        ptr_(make_heap_pimpl<value_type, allocator_type>(move(x.get())))
-    {}
+        ptr_(move(x.ptr_))
+    {
+        pimpl_record_move<value_type>();
+    }
 
     unique_heap_pimpl(
         unique_heap_pimpl&& x,
         const allocator_type& alloc
     )
-    noexcept:
-        ptr_(allocate_heap_pimpl<value_type>(alloc, move(x.get())))
-    {}
+    noexcept(traits_type::is_always_equal::value):
+        ptr_(move_construct(x, alloc, typename traits_type::is_always_equal()))
+    {
+        pimpl_record_move<value_type>();
+    }
 
     unique_heap_pimpl(
         value_type&& x
-    )
-    noexcept:
+    ):
         ptr_(make_heap_pimpl<value_type, allocator_type>(move(x)))
     {}
 
     unique_heap_pimpl(
         value_type&& x,
         const allocator_type& alloc
-    )
-    noexcept:
+    ):
         ptr_(allocate_heap_pimpl<value_type>(alloc, move(x)))
     {}
 
@@ -298,7 +526,8 @@ public:
     )
     {
         if (this != &x) {
-            get() = x.get();
+            assign(x.get());
+            pimpl_record_copy<value_type>();
         }
         return *this;
     }
@@ -308,7 +537,7 @@ public:
         const value_type& x
     )
     {
-        get() = x;
+        assign(x);
         return *this;
     }
 
@@ -316,10 +545,11 @@ public:
     operator=(
         unique_heap_pimpl&& x
     )
-    noexcept
+    noexcept(move_assign_steals::value)
     {
         if (this != &x) {
-            ptr_ = move(x.ptr_);
+            move_assign(x, move_assign_steals());
+            pimpl_record_move<value_type>();
         }
         return *this;
     }
@@ -328,9 +558,8 @@ public:
     operator=(
         value_type&& x
     )
-    noexcept
     {
-        get() = move(x);
+        assign(move(x));
         return *this;
     }
 
@@ -391,6 +620,13 @@ public:
         return *ptr_;
     }
 
+    allocator_type
+    get_allocator()
+    const noexcept
+    {
+        return ptr_.get_deleter().get_allocator();
+    }
+
     // Modifiers
     void
     swap(
@@ -398,13 +634,101 @@ public:
     )
     noexcept
     {
-        using is_always_equal = typename traits_type::is_always_equal;
-        return swap_impl(x, is_always_equal());
+        return swap_impl(x, swap_propagates());
     }
 
 private:
     storage_type ptr_;
 
+    // Moves can steal the pointer if the allocator is propagated
+    // or every instance of the allocator compares equal.
+    using move_assign_steals = integral_constant<bool,
+        traits_type::propagate_on_container_move_assignment::value ||
+        traits_type::is_always_equal::value
+    >;
+
+    // Swaps exchange the allocators if they are propagated, or
+    // every instance of the allocator compares equal.
+    using swap_propagates = integral_constant<bool,
+        traits_type::propagate_on_container_swap::value ||
+        traits_type::is_always_equal::value
+    >;
+
+    static
+    storage_type
+    move_construct(
+        unique_heap_pimpl& x,
+        const allocator_type&,
+        true_type
+    )
+    noexcept
+    {
+        return move(x.ptr_);
+    }
+
+    static
+    storage_type
+    move_construct(
+        unique_heap_pimpl& x,
+        const allocator_type& alloc,
+        false_type
+    )
+    {
+        if (alloc == x.get_allocator()) {
+            return move(x.ptr_);
+        }
+        // a moved-from source has no value to move, so stay empty,
+        // like stealing the null pointer
+        if (!x.ptr_) {
+            return storage_type(nullptr, deleter_type(alloc));
+        }
+        return allocate_heap_pimpl<value_type>(alloc, move(x.get()));
+    }
+
+    void
+    move_assign(
+        unique_heap_pimpl& x,
+        true_type
+    )
+    noexcept
+    {
+        ptr_ = move(x.ptr_);
+    }
+
+    void
+    move_assign(
+        unique_heap_pimpl& x,
+        false_type
+    )
+    {
+        // cannot take ownership of memory from an unequal allocator
+        if (get_allocator() == x.get_allocator()) {
+            value_type* p = x.ptr_.release();
+            ptr_.reset(p);
+        } else if (!x.ptr_) {
+            // keep our allocator, but become empty, like stealing
+            // the null pointer
+            ptr_.reset();
+        } else {
+            assign(move(x.get()));
+        }
+    }
+
+    // A moved-from wrapper holds no value, so re-create the
+    // implied member from our own allocator.
+    template <typename U>
+    void
+    assign(
+        U&& x
+    )
+    {
+        if (ptr_) {
+            get() = forward<U>(x);
+        } else {
+            ptr_ = allocate_heap_pimpl<value_type>(get_allocator(), forward<U>(x));
+        }
+    }
+
     void
     swap_impl(
         unique_heap_pimpl& x,
@@ -464,23 +788,33 @@ public:
 
     // Constructors
     shared_heap_pimpl():
-        ptr_(PYCPP_NAMESPACE::make_shared<value_type>())
+        ptr_(make_shared_pimpl<value_type>())
     {}
 
     template <typename Allocator>
     shared_heap_pimpl(
         const Allocator& alloc
     ):
-        ptr_(PYCPP_NAMESPACE::allocate_shared<value_type>(alloc))
+        ptr_(allocate_shared_pimpl<value_type>(alloc))
     {}
 
     // Copy constructors
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    shared_heap_pimpl(
+        const shared_heap_pimpl& x
+    ):
+        ptr_(x.ptr_)
+    {
+        pimpl_record_copy<value_type>();
+    }
+#else
     shared_heap_pimpl(const shared_heap_pimpl& x) = default;
+#endif
 
     shared_heap_pimpl(
         const value_type& x
     ):
-        ptr_(PYCPP_NAMESPACE::make_shared<value_type>(x))
+        ptr_(make_shared_pimpl<value_type>(x))
     {}
 
     template <typename Allocator>
@@ -488,17 +822,28 @@ public:
         const value_type& x,
         const Allocator& alloc
     ):
-        ptr_(PYCPP_NAMESPACE::allocate_shared<value_type>(alloc, x))
+        ptr_(allocate_shared_pimpl<value_type>(alloc, x))
     {}
 
     // Move constructors
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    shared_heap_pimpl(
+        shared_heap_pimpl&& x
+    )
+    noexcept:
+        ptr_(move(x.ptr_))
+    {
+        pimpl_record_move<value_type>();
+    }
+#else
     shared_heap_pimpl(shared_heap_pimpl&& x) noexcept = default;
+#endif
 
     shared_heap_pimpl(
         value_type&& x
     )
     noexcept:
-        ptr_(PYCPP_NAMESPACE::make_shared<value_type>(move(x)))
+        ptr_(make_shared_pimpl<value_type>(move(x)))
     {}
 
     template <typename Allocator>
@@ -507,12 +852,58 @@ public:
         const Allocator& alloc
     )
     noexcept:
-        ptr_(PYCPP_NAMESPACE::allocate_shared<value_type>(alloc, move(x)))
+        ptr_(allocate_shared_pimpl<value_type>(alloc, move(x)))
     {}
 
+    // Aliasing constructors
+    // Shares the ownership of `owner`, while referring to `p`,
+    // usually a sub-object of the implied member of `owner`.
+    template <typename U>
+    shared_heap_pimpl(
+        const shared_heap_pimpl<U>& owner,
+        pointer p
+    )
+    noexcept:
+        ptr_(owner.ptr_, p)
+    {}
+
+    template <typename U>
+    shared_heap_pimpl(
+        shared_heap_pimpl<U>&& owner,
+        pointer p
+    )
+    noexcept:
+        ptr_(owner.ptr_, p)
+    {
+        owner.ptr_.reset();
+    }
+
     // Assignment
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    shared_heap_pimpl&
+    operator=(
+        const shared_heap_pimpl& x
+    )
+    {
+        ptr_ = x.ptr_;
+        pimpl_record_copy<value_type>();
+        return *this;
+    }
+
+    shared_heap_pimpl&
+    operator=(
+        shared_heap_pimpl&& x
+    )
+    noexcept
+    {
+        ptr_ = move(x.ptr_);
+        pimpl_record_move<value_type>();
+        return *this;
+    }
+#else
     shared_heap_pimpl& operator=(const shared_heap_pimpl&) = default;
     shared_heap_pimpl& operator=(shared_heap_pimpl&& x) noexcept = default;
+#endif
 
     shared_heap_pimpl&
     operator=(
@@ -591,6 +982,45 @@ public:
         return *ptr_;
     }
 
+    long
+    use_count()
+    const noexcept
+    {
+        return ptr_.use_count();
+    }
+
+    // False once moved-from, or when locked from an expired
+    // `weak_heap_pimpl`.
+    explicit
+    operator
+    bool()
+    const noexcept
+    {
+        return static_cast<bool>(ptr_);
+    }
+
+    // Order by the owner, rather than the address, for example,
+    // to key a cache on wrappers aliasing a single owner.
+    template <typename U>
+    bool
+    owner_before(
+        const shared_heap_pimpl<U>& x
+    )
+    const noexcept
+    {
+        return ptr_.owner_before(x.ptr_);
+    }
+
+    template <typename U>
+    bool
+    owner_before(
+        const weak_heap_pimpl<U>& x
+    )
+    const noexcept
+    {
+        return ptr_.owner_before(x.ptr_);
+    }
+
     // Modifiers
     void
     swap(
@@ -602,7 +1032,20 @@ public:
     }
 
 private:
+    template <typename U>
+    friend class shared_heap_pimpl;
+
+    template <typename U>
+    friend class weak_heap_pimpl;
+
     storage_type ptr_;
+
+    shared_heap_pimpl(
+        storage_type&& ptr
+    )
+    noexcept:
+        ptr_(move(ptr))
+    {}
 };
 
 template <typename T>
@@ -616,5 +1059,147 @@ noexcept
     return x.swap(y);
 }
 
+// WEAK HEAP PIMPL
+
+/**
+ *  \brief Non-owning reference to a `shared_heap_pimpl`.
+ */
+template <typename T>
+class weak_heap_pimpl
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using storage_type = weak_ptr<value_type>;
+
+    // Constructors
+    weak_heap_pimpl() noexcept = default;
+
+    weak_heap_pimpl(
+        const shared_heap_pimpl<T>& x
+    )
+    noexcept:
+        ptr_(x.ptr_)
+    {}
+
+    weak_heap_pimpl(const weak_heap_pimpl& x) noexcept = default;
+    weak_heap_pimpl(weak_heap_pimpl&& x) noexcept = default;
+
+    // Assignment
+    weak_heap_pimpl&
+    operator=(
+        const shared_heap_pimpl<T>& x
+    )
+    noexcept
+    {
+        ptr_ = x.ptr_;
+        return *this;
+    }
+
+    weak_heap_pimpl& operator=(const weak_heap_pimpl& x) noexcept = default;
+    weak_heap_pimpl& operator=(weak_heap_pimpl&& x) noexcept = default;
+
+    // Observers
+    // Owning wrapper, which is empty if the member was destroyed.
+    shared_heap_pimpl<T>
+    lock()
+    const noexcept
+    {
+        return shared_heap_pimpl<T>(ptr_.lock());
+    }
+
+    bool
+    expired()
+    const noexcept
+    {
+        return ptr_.expired();
+    }
+
+    long
+    use_count()
+    const noexcept
+    {
+        return ptr_.use_count();
+    }
+
+    template <typename U>
+    bool
+    owner_before(
+        const shared_heap_pimpl<U>& x
+    )
+    const noexcept
+    {
+        return ptr_.owner_before(x.ptr_);
+    }
+
+    template <typename U>
+    bool
+    owner_before(
+        const weak_heap_pimpl<U>& x
+    )
+    const noexcept
+    {
+        return ptr_.owner_before(x.ptr_);
+    }
+
+    // Modifiers
+    void
+    reset()
+    noexcept
+    {
+        ptr_.reset();
+    }
+
+    void
+    swap(
+        weak_heap_pimpl& x
+    )
+    noexcept
+    {
+        ptr_.swap(x.ptr_);
+    }
+
+private:
+    template <typename U>
+    friend class shared_heap_pimpl;
+
+    template <typename U>
+    friend class weak_heap_pimpl;
+
+    storage_type ptr_;
+};
+
+template <typename T>
+void
+swap(
+    weak_heap_pimpl<T>& x,
+    weak_heap_pimpl<T>& y
+)
+noexcept
+{
+    return x.swap(y);
+}
+
+// SPECIALIZATION
+// --------------
+
+// Both wrappers only hold pointers and the allocator, none of
+// which refer back to the address of the wrapper.
+
+template <typename T, typename Allocator>
+struct is_relocatable<unique_heap_pimpl<T, Allocator>>: integral_constant<bool,
+        is_empty<Allocator>::value || is_relocatable<Allocator>::value
+    >
+{};
+
+template <typename T>
+struct is_relocatable<shared_heap_pimpl<T>>: true_type
+{};
+
+template <typename T>
+struct is_relocatable<weak_heap_pimpl<T>>: true_type
+{};
+
 PYCPP_END_NAMESPACE
 
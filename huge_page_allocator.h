@@ -0,0 +1,348 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Allocator backing large instances with huge pages.
+ *
+ *  Large, randomly accessed instances, such as lookup tables and
+ *  dictionaries, miss the TLB on almost every access when backed by
+ *  regular pages. `huge_page_allocator` maps allocations of at least
+ *  one huge page directly, rounded to a whole number of huge pages
+ *  and aligned to the huge page size, so each huge page covers what
+ *  would otherwise take hundreds of TLB entries.
+ *
+ *  With `huge_page_transparent`, the mapping is advised for transparent
+ *  huge pages, which the kernel may back with huge pages on demand.
+ *  With `huge_page_explicit`, the mapping is reserved from the huge
+ *  page pool, for example, configured with `vm.nr_hugepages`, falling
+ *  back to transparent huge pages when the pool is exhausted.
+ *  Smaller allocations, and every allocation on platforms without huge
+ *  page support, use the global `operator new`.
+ *
+ *  The allocator may be used as the `Allocator` of `heap_singleton`
+ *  or of the heap PIMPL wrappers.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/huge_page_allocator.h>
+ *
+ *      struct dictionary: heap_singleton<dictionary, true, huge_page_allocator<dictionary>>
+ *      {};
+ *
+ *  \synopsis
+ *      enum huge_page_policy
+ *      {
+ *          huge_page_transparent,
+ *          huge_page_explicit,
+ *      };
+ *
+ *      size_t huge_page_size() noexcept;
+ *
+ *      template <typename T, huge_page_policy Policy = huge_page_transparent>
+ *      class huge_page_allocator
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using size_type = size_t;
+ *          using difference_type = ptrdiff_t;
+ *          using is_always_equal = true_type;
+ *          template <typename U> struct rebind { using other = huge_page_allocator<U, Policy>; };
+ *
+ *          huge_page_allocator() noexcept;
+ *          template <typename U> huge_page_allocator(const huge_page_allocator<U, Policy>&) noexcept;
+ *
+ *          value_type* allocate(size_type n);
+ *          void deallocate(value_type* p, size_type n) noexcept;
+ *      };
+ *
+ *      template <typename T, typename U, huge_page_policy Policy>
+ *      bool operator==(const huge_page_allocator<T, Policy>&, const huge_page_allocator<U, Policy>&) noexcept;
+ *
+ *      template <typename T, typename U, huge_page_policy Policy>
+ *      bool operator!=(const huge_page_allocator<T, Policy>&, const huge_page_allocator<U, Policy>&) noexcept;
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/relocate.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/type_traits.h>
+
+#if defined(__linux__)
+#   include <stdio.h>
+#   include <sys/mman.h>
+#endif
+
+PYCPP_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Method used to request huge pages.
+ */
+enum huge_page_policy
+{
+    huge_page_transparent,
+    huge_page_explicit,
+};
+
+namespace huge_page_detail
+{
+// DETAIL
+// ------
+
+constexpr size_t default_huge_page_size = 2 * 1024 * 1024;
+
+#if defined(__linux__)
+
+inline
+size_t
+read_huge_page_size()
+noexcept
+{
+    FILE* file = fopen("/proc/meminfo", "r");
+    if (file == nullptr) {
+        return default_huge_page_size;
+    }
+    size_t size = default_huge_page_size;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long kib;
+        if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) {
+            size = static_cast<size_t>(kib) * 1024;
+            break;
+        }
+    }
+    fclose(file);
+    return size;
+}
+
+
+// Map `bytes`, a multiple of `alignment`, aligned to `alignment`,
+// by over-allocating and trimming both ends.
+inline
+void*
+map_aligned(
+    size_t bytes,
+    size_t alignment
+)
+{
+    size_t mapped = bytes + alignment;
+    void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw bad_alloc();
+    }
+
+    char* first = static_cast<char*>(p);
+    uintptr_t i = reinterpret_cast<uintptr_t>(first);
+    char* aligned = first + ((alignment - i % alignment) % alignment);
+    char* last = aligned + bytes;
+    if (aligned != first) {
+        munmap(first, static_cast<size_t>(aligned - first));
+    }
+    if (last != first + mapped) {
+        munmap(last, static_cast<size_t>(first + mapped - last));
+    }
+    return aligned;
+}
+
+
+inline
+void*
+map_transparent(
+    size_t bytes,
+    size_t alignment
+)
+{
+    void* p = map_aligned(bytes, alignment);
+#if defined(MADV_HUGEPAGE)
+    // only advisory, so failures leave regular pages
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+
+inline
+void*
+map_explicit(
+    size_t bytes,
+    size_t alignment
+)
+{
+#if defined(MAP_HUGETLB)
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        return p;
+    }
+#endif
+    return map_transparent(bytes, alignment);
+}
+
+
+inline
+void*
+map_huge(
+    size_t bytes,
+    size_t alignment,
+    integral_constant<huge_page_policy, huge_page_transparent>
+)
+{
+    return map_transparent(bytes, alignment);
+}
+
+
+inline
+void*
+map_huge(
+    size_t bytes,
+    size_t alignment,
+    integral_constant<huge_page_policy, huge_page_explicit>
+)
+{
+    return map_explicit(bytes, alignment);
+}
+
+#endif                                          // __linux__
+
+}   /* huge_page_detail */
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Default huge page size of the system.
+ */
+inline
+size_t
+huge_page_size()
+noexcept
+{
+#if defined(__linux__)
+    static const size_t size = huge_page_detail::read_huge_page_size();
+    return size;
+#else
+    return huge_page_detail::default_huge_page_size;
+#endif
+}
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Allocator mapping large allocations to huge pages.
+ */
+template <typename T, huge_page_policy Policy = huge_page_transparent>
+class huge_page_allocator
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using is_always_equal = true_type;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = huge_page_allocator<U, Policy>;
+    };
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    huge_page_allocator() noexcept = default;
+    huge_page_allocator(const huge_page_allocator&) noexcept = default;
+    huge_page_allocator& operator=(const huge_page_allocator&) noexcept = default;
+
+    template <typename U>
+    huge_page_allocator(
+        const huge_page_allocator<U, Policy>&
+    )
+    noexcept
+    {}
+
+    value_type*
+    allocate(
+        size_type n
+    )
+    {
+        size_t bytes = n * sizeof(value_type);
+#if defined(__linux__)
+        size_t page = huge_page_size();
+        if (bytes >= page) {
+            using policy = integral_constant<huge_page_policy, Policy>;
+            return static_cast<value_type*>(huge_page_detail::map_huge(round(bytes, page), page, policy()));
+        }
+#endif
+        return static_cast<value_type*>(::operator new(bytes));
+    }
+
+    void
+    deallocate(
+        value_type* p,
+        size_type n
+    )
+    noexcept
+    {
+        size_t bytes = n * sizeof(value_type);
+#if defined(__linux__)
+        size_t page = huge_page_size();
+        if (bytes >= page) {
+            munmap(static_cast<void*>(p), round(bytes, page));
+            return;
+        }
+#endif
+        ::operator delete(static_cast<void*>(p));
+    }
+
+private:
+    static
+    size_t
+    round(
+        size_t bytes,
+        size_t page
+    )
+    noexcept
+    {
+        return (bytes + page - 1) / page * page;
+    }
+};
+
+
+template <typename T, typename U, huge_page_policy Policy>
+inline
+bool
+operator==(
+    const huge_page_allocator<T, Policy>&,
+    const huge_page_allocator<U, Policy>&
+)
+noexcept
+{
+    return true;
+}
+
+
+template <typename T, typename U, huge_page_policy Policy>
+inline
+bool
+operator!=(
+    const huge_page_allocator<T, Policy>& x,
+    const huge_page_allocator<U, Policy>& y
+)
+noexcept
+{
+    return !(x == y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T, huge_page_policy Policy>
+struct is_relocatable<huge_page_allocator<T, Policy>>: true_type
+{};
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,605 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Heap PIMPL idiom with shared semantics and an intrusive count.
+ *
+ *  Alternative to `shared_heap_pimpl` which stores the reference
+ *  count and the implied member in a single allocation, without
+ *  the weak count or type-erased deleter of `shared_ptr`. The
+ *  reference-counting policy controls the synchronization cost of
+ *  copying and destroying the wrapper:
+ *
+ *      - `atomic_refcount`: Thread-safe count using atomics.
+ *      - `nonatomic_refcount`: Plain count, for objects confined to
+ *          a single thread.
+ *      - `biased_refcount`: The thread creating the object updates a
+ *          plain count, while other threads use an atomic count. The
+ *          object is destroyed once both counts reach zero. References
+ *          taken on the owning thread **must** be released on the
+ *          owning thread, while other threads may copy and release
+ *          their own references freely.
+ *
+ *  Like `unique_heap_pimpl`, the moved-from wrapper holds no value,
+ *  and may only be assigned to, swapped or destroyed.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/intrusive_pimpl.h>
+ *
+ *      struct file_impl;
+ *      struct file
+ *      {
+ *      public:
+ *      private:
+ *          intrusive_heap_pimpl<file_impl, nonatomic_refcount> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      struct atomic_refcount;
+ *      struct nonatomic_refcount;
+ *      struct biased_refcount;
+ *
+ *      template <
+ *          typename T,
+ *          typename RefCount = atomic_refcount,
+ *          typename Allocator = allocator<T>
+ *      >
+ *      class intrusive_heap_pimpl
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *          using refcount_type = RefCount;
+ *          using allocator_type = Allocator;
+ *
+ *          intrusive_heap_pimpl();
+ *          intrusive_heap_pimpl(const allocator_type& alloc);
+ *          intrusive_heap_pimpl(const intrusive_heap_pimpl& x) noexcept;
+ *          intrusive_heap_pimpl(const value_type& x);
+ *          intrusive_heap_pimpl(const value_type& x, const allocator_type& alloc);
+ *          intrusive_heap_pimpl(intrusive_heap_pimpl&& x) noexcept;
+ *          intrusive_heap_pimpl(value_type&& x);
+ *          intrusive_heap_pimpl(value_type&& x, const allocator_type& alloc);
+ *          intrusive_heap_pimpl& operator=(const intrusive_heap_pimpl& x) noexcept;
+ *          intrusive_heap_pimpl& operator=(intrusive_heap_pimpl&& x) noexcept;
+ *          intrusive_heap_pimpl& operator=(const value_type& x);
+ *          intrusive_heap_pimpl& operator=(value_type&& x);
+ *          ~intrusive_heap_pimpl();
+ *
+ *          reference operator*() noexcept;
+ *          const_reference operator*() const noexcept;
+ *          pointer operator->() noexcept;
+ *          const_pointer operator->() const noexcept;
+ *          operator reference() noexcept;
+ *          operator const_reference() const noexcept;
+ *          reference get() noexcept;
+ *          const_reference get() const noexcept;
+ *          size_t use_count() const noexcept;
+ *
+ *          void swap(intrusive_heap_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename T, typename RefCount, typename Allocator>
+ *      void swap(intrusive_heap_pimpl<T, RefCount, Allocator>& x, intrusive_heap_pimpl<T, RefCount, Allocator>& y) noexcept;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/relocate.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/thread.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// POLICIES
+// --------
+
+// Each policy starts with a single reference, owned by the
+// creating wrapper, and hands out a token per reference, which
+// must be passed back when the reference is released.
+
+/**
+ *  \brief Thread-safe reference count.
+ */
+struct atomic_refcount
+{
+    struct token_type
+    {};
+
+    token_type
+    acquire()
+    noexcept
+    {
+        count_.fetch_add(1, memory_order_relaxed);
+        return token_type();
+    }
+
+    bool
+    release(
+        token_type
+    )
+    noexcept
+    {
+        return count_.fetch_sub(1, memory_order_acq_rel) == 1;
+    }
+
+    size_t
+    use_count()
+    const noexcept
+    {
+        return count_.load(memory_order_relaxed);
+    }
+
+    static
+    token_type
+    initial()
+    noexcept
+    {
+        return token_type();
+    }
+
+private:
+    atomic<size_t> count_ = ATOMIC_VAR_INIT(1);
+};
+
+
+/**
+ *  \brief Reference count for objects confined to a single thread.
+ */
+struct nonatomic_refcount
+{
+    struct token_type
+    {};
+
+    token_type
+    acquire()
+    noexcept
+    {
+        ++count_;
+        return token_type();
+    }
+
+    bool
+    release(
+        token_type
+    )
+    noexcept
+    {
+        return --count_ == 0;
+    }
+
+    size_t
+    use_count()
+    const noexcept
+    {
+        return count_;
+    }
+
+    static
+    token_type
+    initial()
+    noexcept
+    {
+        return token_type();
+    }
+
+private:
+    size_t count_ = 1;
+};
+
+
+/**
+ *  \brief Reference count biased towards the creating thread.
+ *
+ *  The owning thread updates a plain count, and other threads update
+ *  an atomic count, whose lowest bit is set once the owning thread
+ *  has released all its references. Whichever thread observes both
+ *  counts reach zero destroys the object.
+ */
+struct biased_refcount
+{
+    struct token_type
+    {
+        bool biased;
+    };
+
+    token_type
+    acquire()
+    noexcept
+    {
+        if (this_thread::get_id() == owner_ && !merged_) {
+            ++biased_;
+            return token_type {true};
+        }
+        shared_.fetch_add(2, memory_order_relaxed);
+        return token_type {false};
+    }
+
+    bool
+    release(
+        token_type token
+    )
+    noexcept
+    {
+        if (token.biased) {
+            assert(this_thread::get_id() == owner_ && "Biased reference released on another thread.");
+            if (--biased_ != 0) {
+                return false;
+            }
+            merged_ = true;
+            return shared_.fetch_or(1, memory_order_acq_rel) == 0;
+        }
+        // last shared reference, after the owner released its references
+        return shared_.fetch_sub(2, memory_order_acq_rel) == 3;
+    }
+
+    // Only exact on the owning thread.
+    size_t
+    use_count()
+    const noexcept
+    {
+        size_t count = shared_.load(memory_order_relaxed) >> 1;
+        if (this_thread::get_id() == owner_) {
+            count += biased_;
+        }
+        return count;
+    }
+
+    static
+    token_type
+    initial()
+    noexcept
+    {
+        return token_type {true};
+    }
+
+private:
+    thread::id owner_ = this_thread::get_id();
+    size_t biased_ = 1;
+    bool merged_ = false;
+    atomic<size_t> shared_ = ATOMIC_VAR_INIT(0);
+};
+
+namespace intrusive_detail
+{
+// DETAIL
+// ------
+
+template <typename T, typename RefCount, typename Allocator>
+struct intrusive_node
+{
+    RefCount count;
+    Allocator alloc;
+    T value;
+
+    template <typename ... Ts>
+    intrusive_node(
+        const Allocator& a,
+        Ts&&... ts
+    ):
+        alloc(a),
+        value(forward<Ts>(ts)...)
+    {}
+};
+
+// Derive from the token to avoid any overhead for empty tokens.
+template <typename Node, typename Token>
+struct intrusive_storage: Token
+{
+    Node* ptr = nullptr;
+
+    intrusive_storage() = default;
+
+    intrusive_storage(
+        Node* p,
+        Token t
+    )
+    noexcept:
+        Token(t),
+        ptr(p)
+    {}
+};
+
+}   /* intrusive_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief PIMPL idiom with shared semantics and a policy-based intrusive count.
+ */
+template <
+    typename T,
+    typename RefCount = atomic_refcount,
+    typename Allocator = allocator<T>
+>
+class intrusive_heap_pimpl
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using refcount_type = RefCount;
+    using allocator_type = Allocator;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    // Constructors
+    intrusive_heap_pimpl():
+        data_(create(allocator_type()))
+    {}
+
+    intrusive_heap_pimpl(
+        const allocator_type& alloc
+    ):
+        data_(create(alloc))
+    {}
+
+    // Copy constructors
+    intrusive_heap_pimpl(
+        const intrusive_heap_pimpl& x
+    )
+    noexcept:
+        data_(x.share())
+    {}
+
+    intrusive_heap_pimpl(
+        const value_type& x
+    ):
+        data_(create(allocator_type(), x))
+    {}
+
+    intrusive_heap_pimpl(
+        const value_type& x,
+        const allocator_type& alloc
+    ):
+        data_(create(alloc, x))
+    {}
+
+    // Move constructors
+    intrusive_heap_pimpl(
+        intrusive_heap_pimpl&& x
+    )
+    noexcept:
+        data_(x.data_)
+    {
+        x.data_.ptr = nullptr;
+    }
+
+    intrusive_heap_pimpl(
+        value_type&& x
+    ):
+        data_(create(allocator_type(), move(x)))
+    {}
+
+    intrusive_heap_pimpl(
+        value_type&& x,
+        const allocator_type& alloc
+    ):
+        data_(create(alloc, move(x)))
+    {}
+
+    // Assignment
+    intrusive_heap_pimpl&
+    operator=(
+        const intrusive_heap_pimpl& x
+    )
+    noexcept
+    {
+        if (this != &x) {
+            storage_type tmp = x.share();
+            reset();
+            data_ = tmp;
+        }
+        return *this;
+    }
+
+    intrusive_heap_pimpl&
+    operator=(
+        intrusive_heap_pimpl&& x
+    )
+    noexcept
+    {
+        if (this != &x) {
+            reset();
+            data_ = x.data_;
+            x.data_.ptr = nullptr;
+        }
+        return *this;
+    }
+
+    intrusive_heap_pimpl&
+    operator=(
+        const value_type& x
+    )
+    {
+        assign(x);
+        return *this;
+    }
+
+    intrusive_heap_pimpl&
+    operator=(
+        value_type&& x
+    )
+    {
+        assign(move(x));
+        return *this;
+    }
+
+    ~intrusive_heap_pimpl()
+    {
+        reset();
+    }
+
+    // Observers
+    reference
+    operator*()
+    noexcept
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const noexcept
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    noexcept
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const noexcept
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    noexcept
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const noexcept
+    {
+        return get();
+    }
+
+    reference
+    get()
+    noexcept
+    {
+        return data_.ptr->value;
+    }
+
+    const_reference
+    get()
+    const noexcept
+    {
+        return data_.ptr->value;
+    }
+
+    size_t
+    use_count()
+    const noexcept
+    {
+        return data_.ptr ? data_.ptr->count.use_count() : 0;
+    }
+
+    // Modifiers
+    void
+    swap(
+        intrusive_heap_pimpl& x
+    )
+    noexcept
+    {
+        fast_swap(data_, x.data_);
+    }
+
+private:
+    using token_type = typename refcount_type::token_type;
+    using node_type = intrusive_detail::intrusive_node<value_type, refcount_type, allocator_type>;
+    using storage_type = intrusive_detail::intrusive_storage<node_type, token_type>;
+    using node_allocator = typename allocator_traits<allocator_type>::template rebind_alloc<node_type>;
+    using node_traits = allocator_traits<node_allocator>;
+
+    storage_type data_;
+
+    template <typename ... Ts>
+    static
+    storage_type
+    create(
+        const allocator_type& alloc,
+        Ts&&... ts
+    )
+    {
+        node_allocator a(alloc);
+        node_type* p = node_traits::allocate(a, 1);
+        try {
+            node_traits::construct(a, p, alloc, forward<Ts>(ts)...);
+        } catch (...) {
+            node_traits::deallocate(a, p, 1);
+            throw;
+        }
+        return storage_type(p, refcount_type::initial());
+    }
+
+    storage_type
+    share()
+    const noexcept
+    {
+        if (data_.ptr == nullptr) {
+            return storage_type();
+        }
+        return storage_type(data_.ptr, data_.ptr->count.acquire());
+    }
+
+    void
+    reset()
+    noexcept
+    {
+        node_type* p = data_.ptr;
+        data_.ptr = nullptr;
+        if (p != nullptr && p->count.release(static_cast<token_type&>(data_))) {
+            node_allocator a(p->alloc);
+            node_traits::destroy(a, p);
+            node_traits::deallocate(a, p, 1);
+        }
+    }
+
+    // A moved-from wrapper holds no value, so re-create the
+    // implied member.
+    template <typename U>
+    void
+    assign(
+        U&& x
+    )
+    {
+        if (data_.ptr) {
+            get() = forward<U>(x);
+        } else {
+            data_ = create(allocator_type(), forward<U>(x));
+        }
+    }
+};
+
+template <typename T, typename RefCount, typename Allocator>
+void
+swap(
+    intrusive_heap_pimpl<T, RefCount, Allocator>& x,
+    intrusive_heap_pimpl<T, RefCount, Allocator>& y
+)
+noexcept
+{
+    return x.swap(y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T, typename RefCount, typename Allocator>
+struct is_relocatable<intrusive_heap_pimpl<T, RefCount, Allocator>>: true_type
+{};
+
+PYCPP_END_NAMESPACE
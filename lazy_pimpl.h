@@ -0,0 +1,856 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief PIMPL idiom deferring construction to the first access.
+ *
+ *  The lazy PIMPL wrappers only default-construct the implied member
+ *  on the first access, so members which are expensive to construct,
+ *  and unused on most code paths, cost neither the construction nor,
+ *  for `lazy_heap_pimpl`, the allocation. Constructing from a value
+ *  constructs the member immediately, and `reset` destroys the member,
+ *  returning the wrapper to the unconstructed state.
+ *
+ *  `lazy_stack_pimpl` stores the member inline like `stack_pimpl`, and
+ *  checks the size and alignment in the destructor, while
+ *  `lazy_heap_pimpl` allocates from `Allocator` like `unique_heap_pimpl`.
+ *  Copies and moves of an unconstructed wrapper remain unconstructed.
+ *  A `lazy_heap_pimpl` move transfers the pointer and the allocator,
+ *  leaving the moved-from wrapper unconstructed.
+ *
+ *  With `ThreadSafe`, the first access may happen concurrently from
+ *  multiple threads, which use the atomic state machine of the
+ *  thread-safe `stack_singleton`: a single thread constructs the
+ *  member, while the others wait for it to be published, and every
+ *  following access is a single acquire load. Otherwise, the wrappers
+ *  follow the usual rules for concurrent use of an object.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/lazy_pimpl.h>
+ *
+ *      struct parser_impl;
+ *      struct parser
+ *      {
+ *      public:
+ *      private:
+ *          lazy_heap_pimpl<parser_impl> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      template <
+ *          typename T,
+ *          size_t Size = sizeof(T),
+ *          size_t Alignment = alignof(max_align_t),
+ *          bool ThreadSafe = false
+ *      >
+ *      class lazy_stack_pimpl
+ *      {
+ *      public:
+ *          static constexpr size_t size = Size;
+ *          static constexpr size_t alignment = Alignment;
+ *          static constexpr bool thread_safe = ThreadSafe;
+ *
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *
+ *          lazy_stack_pimpl() noexcept;
+ *          lazy_stack_pimpl(const lazy_stack_pimpl& x);
+ *          lazy_stack_pimpl& operator=(const lazy_stack_pimpl& x);
+ *          lazy_stack_pimpl(lazy_stack_pimpl&& x);
+ *          lazy_stack_pimpl& operator=(lazy_stack_pimpl&& x);
+ *          lazy_stack_pimpl(const value_type& x);
+ *          lazy_stack_pimpl& operator=(const value_type& x);
+ *          lazy_stack_pimpl(value_type&& x);
+ *          lazy_stack_pimpl& operator=(value_type&& x);
+ *          ~lazy_stack_pimpl();
+ *
+ *          reference operator*();
+ *          const_reference operator*() const;
+ *          pointer operator->();
+ *          const_pointer operator->() const;
+ *          operator reference();
+ *          operator const_reference() const;
+ *          reference get();
+ *          const_reference get() const;
+ *          bool constructed() const noexcept;
+ *
+ *          void reset() noexcept;
+ *          void swap(lazy_stack_pimpl& x);
+ *      };
+ *
+ *      template <typename T, typename Allocator = allocator<T>, bool ThreadSafe = false>
+ *      class lazy_heap_pimpl
+ *      {
+ *      public:
+ *          static constexpr bool thread_safe = ThreadSafe;
+ *
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *          using allocator_type = Allocator;
+ *          using deleter_type = implementation-defined;
+ *          using storage_type = unique_ptr<value_type, deleter_type>;
+ *
+ *          lazy_heap_pimpl();
+ *          lazy_heap_pimpl(const allocator_type& alloc);
+ *          lazy_heap_pimpl(const lazy_heap_pimpl& x);
+ *          lazy_heap_pimpl& operator=(const lazy_heap_pimpl& x);
+ *          lazy_heap_pimpl(lazy_heap_pimpl&& x) noexcept;
+ *          lazy_heap_pimpl& operator=(lazy_heap_pimpl&& x) noexcept(see below);
+ *          lazy_heap_pimpl(const value_type& x);
+ *          lazy_heap_pimpl(const value_type& x, const allocator_type& alloc);
+ *          lazy_heap_pimpl& operator=(const value_type& x);
+ *          lazy_heap_pimpl(value_type&& x);
+ *          lazy_heap_pimpl(value_type&& x, const allocator_type& alloc);
+ *          lazy_heap_pimpl& operator=(value_type&& x);
+ *
+ *          reference operator*();
+ *          const_reference operator*() const;
+ *          pointer operator->();
+ *          const_pointer operator->() const;
+ *          operator reference();
+ *          operator const_reference() const;
+ *          reference get();
+ *          const_reference get() const;
+ *          bool constructed() const noexcept;
+ *          allocator_type get_allocator() const noexcept;
+ *
+ *          void reset() noexcept;
+ *          void swap(lazy_heap_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+ *      struct is_relocatable<lazy_stack_pimpl<T, Size, Alignment, ThreadSafe>>;
+ *
+ *      template <typename T, typename Allocator, bool ThreadSafe>
+ *      struct is_relocatable<lazy_heap_pimpl<T, Allocator, ThreadSafe>>;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/heap_pimpl.h>
+#include <pycpp/adaptor/singleton.h>
+#include <pycpp/adaptor/stack_pimpl.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace lazy_detail
+{
+// DETAIL
+// ------
+
+/**
+ *  \brief Tracks whether the implied member has been constructed.
+ */
+template <bool ThreadSafe>
+class lazy_state;
+
+template <>
+class lazy_state<false>
+{
+public:
+    lazy_state() = default;
+    lazy_state(const lazy_state&) = delete;
+    lazy_state& operator=(const lazy_state&) = delete;
+
+    bool
+    constructed()
+    const noexcept
+    {
+        return constructed_;
+    }
+
+    void
+    store(
+        bool constructed
+    )
+    noexcept
+    {
+        constructed_ = constructed;
+    }
+
+    template <typename Function>
+    void
+    call_once(
+        Function f
+    )
+    {
+        if (!constructed_) {
+            f();
+            constructed_ = true;
+        }
+    }
+
+private:
+    bool constructed_ = false;
+};
+
+
+template <>
+class lazy_state<true>
+{
+public:
+    lazy_state() = default;
+    lazy_state(const lazy_state&) = delete;
+    lazy_state& operator=(const lazy_state&) = delete;
+
+    bool
+    constructed()
+    const noexcept
+    {
+        return state_.load(memory_order_acquire) == singleton_detail::singleton_initialized;
+    }
+
+    void
+    store(
+        bool constructed
+    )
+    noexcept
+    {
+        using namespace singleton_detail;
+        state_.store(constructed ? singleton_initialized : singleton_uninitialized, memory_order_release);
+    }
+
+    template <typename Function>
+    void
+    call_once(
+        Function f
+    )
+    {
+        using namespace singleton_detail;
+
+        int s = singleton_uninitialized;
+        while (s != singleton_initialized) {
+            if (state_.compare_exchange_strong(s, singleton_initializing, memory_order_acquire)) {
+                // reset the state if construction throws, so another
+                // thread may retry construction
+                try {
+                    f();
+                } catch (...) {
+                    publish_state(state_, singleton_uninitialized);
+                    throw;
+                }
+                publish_state(state_, singleton_initialized);
+                break;
+            }
+            s = wait_initializing(state_);
+        }
+    }
+
+private:
+    atomic<int> state_ = ATOMIC_VAR_INIT(singleton_detail::singleton_uninitialized);
+};
+
+}   /* lazy_detail */
+
+// OBJECTS
+// -------
+
+// LAZY STACK PIMPL
+
+/**
+ *  \brief PIMPL idiom using aligned storage and deferred construction.
+ */
+template <
+    typename T,
+    size_t Size = sizeof(T),
+    size_t Alignment = alignof(max_align_t),
+    bool ThreadSafe = false
+>
+class lazy_stack_pimpl
+{
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t size = Size;
+    static constexpr size_t alignment = Alignment;
+    static constexpr bool thread_safe = ThreadSafe;
+
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    lazy_stack_pimpl()
+    noexcept
+    {}
+
+    lazy_stack_pimpl(
+        const lazy_stack_pimpl& x
+    )
+    {
+        if (x.constructed()) {
+            construct(x.ref());
+        }
+    }
+
+    lazy_stack_pimpl&
+    operator=(
+        const lazy_stack_pimpl& x
+    )
+    {
+        if (this != &x) {
+            if (x.constructed()) {
+                assign(x.ref());
+            } else {
+                reset();
+            }
+        }
+        return *this;
+    }
+
+    lazy_stack_pimpl(
+        lazy_stack_pimpl&& x
+    )
+    {
+        if (x.constructed()) {
+            construct(move(x.ref()));
+        }
+    }
+
+    lazy_stack_pimpl&
+    operator=(
+        lazy_stack_pimpl&& x
+    )
+    {
+        if (this != &x) {
+            if (x.constructed()) {
+                assign(move(x.ref()));
+            } else {
+                reset();
+            }
+        }
+        return *this;
+    }
+
+    lazy_stack_pimpl(
+        const value_type& x
+    )
+    {
+        construct(x);
+    }
+
+    lazy_stack_pimpl&
+    operator=(
+        const value_type& x
+    )
+    {
+        assign(x);
+        return *this;
+    }
+
+    lazy_stack_pimpl(
+        value_type&& x
+    )
+    {
+        construct(move(x));
+    }
+
+    lazy_stack_pimpl&
+    operator=(
+        value_type&& x
+    )
+    {
+        assign(move(x));
+        return *this;
+    }
+
+    ~lazy_stack_pimpl()
+    {
+        pimp_detail::storage_asserter<T, Size, Alignment> {};
+        reset();
+    }
+
+    // CONVERSIONS
+    reference
+    operator*()
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const
+    {
+        return get();
+    }
+
+    reference
+    get()
+    {
+        if (!state_.constructed()) {
+            construct();
+        }
+        return ref();
+    }
+
+    const_reference
+    get()
+    const
+    {
+        if (!state_.constructed()) {
+            construct();
+        }
+        return ref();
+    }
+
+    bool
+    constructed()
+    const noexcept
+    {
+        return state_.constructed();
+    }
+
+    // MODIFIERS
+    void
+    reset()
+    noexcept
+    {
+        if (state_.constructed()) {
+            state_.store(false);
+            ref().~T();
+        }
+    }
+
+    void
+    swap(
+        lazy_stack_pimpl& x
+    )
+    {
+        if (constructed() && x.constructed()) {
+            fast_swap(ref(), x.ref());
+        } else if (constructed()) {
+            x.construct(move(ref()));
+            reset();
+        } else if (x.constructed()) {
+            construct(move(x.ref()));
+            x.reset();
+        }
+    }
+
+private:
+    using memory_type = aligned_storage_t<Size, Alignment>;
+    mutable memory_type mem_;
+    mutable lazy_detail::lazy_state<ThreadSafe> state_;
+
+    value_type&
+    ref()
+    const noexcept
+    {
+        return reinterpret_cast<value_type&>(mem_);
+    }
+
+    template <typename ... Ts>
+    void
+    construct(
+        Ts&&... ts
+    )
+    const
+    {
+        memory_type* p = &mem_;
+        state_.call_once([&]() {
+            new (p) value_type(forward<Ts>(ts)...);
+        });
+    }
+
+    template <typename U>
+    void
+    assign(
+        U&& x
+    )
+    {
+        if (state_.constructed()) {
+            ref() = forward<U>(x);
+        } else {
+            construct(forward<U>(x));
+        }
+    }
+};
+
+// LAZY HEAP PIMPL
+
+/**
+ *  \brief PIMPL idiom using pointer indirection and deferred construction.
+ */
+template <typename T, typename Allocator = allocator<T>, bool ThreadSafe = false>
+class lazy_heap_pimpl
+{
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr bool thread_safe = ThreadSafe;
+
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using allocator_type = Allocator;
+    using deleter_type = heap_detail::heap_pimpl_deleter<T, Allocator>;
+    using storage_type = unique_ptr<value_type, deleter_type>;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    // Constructors
+    lazy_heap_pimpl():
+        ptr_(nullptr, deleter_type(allocator_type()))
+    {}
+
+    lazy_heap_pimpl(
+        const allocator_type& alloc
+    ):
+        ptr_(nullptr, deleter_type(alloc))
+    {}
+
+    // Copy constructors
+    lazy_heap_pimpl(
+        const lazy_heap_pimpl& x
+    ):
+        ptr_(nullptr, deleter_type(allocator_type()))
+    {
+        if (x.constructed()) {
+            construct(x.ref());
+        }
+        pimpl_record_copy<value_type>();
+    }
+
+    lazy_heap_pimpl(
+        const value_type& x
+    ):
+        ptr_(nullptr, deleter_type(allocator_type()))
+    {
+        construct(x);
+    }
+
+    lazy_heap_pimpl(
+        const value_type& x,
+        const allocator_type& alloc
+    ):
+        ptr_(nullptr, deleter_type(alloc))
+    {
+        construct(x);
+    }
+
+    // Move constructors
+    lazy_heap_pimpl(
+        lazy_heap_pimpl&& x
+    )
+    noexcept:
+        ptr_(move(x.ptr_))
+    {
+        state_.store(x.constructed());
+        x.state_.store(false);
+        pimpl_record_move<value_type>();
+    }
+
+    lazy_heap_pimpl(
+        value_type&& x
+    ):
+        ptr_(nullptr, deleter_type(allocator_type()))
+    {
+        construct(move(x));
+    }
+
+    lazy_heap_pimpl(
+        value_type&& x,
+        const allocator_type& alloc
+    ):
+        ptr_(nullptr, deleter_type(alloc))
+    {
+        construct(move(x));
+    }
+
+    // Assignment
+    lazy_heap_pimpl&
+    operator=(
+        const lazy_heap_pimpl& x
+    )
+    {
+        if (this != &x) {
+            if (x.constructed()) {
+                assign(x.ref());
+            } else {
+                reset();
+            }
+            pimpl_record_copy<value_type>();
+        }
+        return *this;
+    }
+
+    lazy_heap_pimpl&
+    operator=(
+        lazy_heap_pimpl&& x
+    )
+    noexcept(move_assign_steals::value)
+    {
+        if (this != &x) {
+            move_assign(x, move_assign_steals());
+            pimpl_record_move<value_type>();
+        }
+        return *this;
+    }
+
+    lazy_heap_pimpl&
+    operator=(
+        const value_type& x
+    )
+    {
+        assign(x);
+        return *this;
+    }
+
+    lazy_heap_pimpl&
+    operator=(
+        value_type&& x
+    )
+    {
+        assign(move(x));
+        return *this;
+    }
+
+    // Observers
+    reference
+    operator*()
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const
+    {
+        return get();
+    }
+
+    reference
+    get()
+    {
+        if (!state_.constructed()) {
+            construct();
+        }
+        return ref();
+    }
+
+    const_reference
+    get()
+    const
+    {
+        if (!state_.constructed()) {
+            construct();
+        }
+        return ref();
+    }
+
+    bool
+    constructed()
+    const noexcept
+    {
+        return state_.constructed();
+    }
+
+    allocator_type
+    get_allocator()
+    const noexcept
+    {
+        return ptr_.get_deleter().get_allocator();
+    }
+
+    // Modifiers
+    void
+    reset()
+    noexcept
+    {
+        if (state_.constructed()) {
+            state_.store(false);
+            ptr_.reset();
+        }
+    }
+
+    void
+    swap(
+        lazy_heap_pimpl& x
+    )
+    noexcept
+    {
+        bool constructed = state_.constructed();
+        state_.store(x.constructed());
+        x.state_.store(constructed);
+        fast_swap(ptr_, x.ptr_);
+    }
+
+private:
+    using traits_type = allocator_traits<allocator_type>;
+
+    mutable storage_type ptr_;
+    mutable lazy_detail::lazy_state<ThreadSafe> state_;
+
+    // Moves can steal the pointer if the allocator is propagated
+    // or every instance of the allocator compares equal.
+    using move_assign_steals = integral_constant<bool,
+        traits_type::propagate_on_container_move_assignment::value ||
+        traits_type::is_always_equal::value
+    >;
+
+    void
+    move_assign(
+        lazy_heap_pimpl& x,
+        true_type
+    )
+    noexcept
+    {
+        ptr_ = move(x.ptr_);
+        state_.store(x.constructed());
+        x.state_.store(false);
+    }
+
+    void
+    move_assign(
+        lazy_heap_pimpl& x,
+        false_type
+    )
+    {
+        // cannot take ownership of memory from an unequal allocator
+        if (get_allocator() == x.get_allocator()) {
+            ptr_.reset(x.ptr_.release());
+            state_.store(x.constructed());
+            x.state_.store(false);
+        } else if (x.constructed()) {
+            assign(move(x.ref()));
+        } else {
+            reset();
+        }
+    }
+
+    value_type&
+    ref()
+    const noexcept
+    {
+        return *ptr_;
+    }
+
+    template <typename ... Ts>
+    void
+    construct(
+        Ts&&... ts
+    )
+    const
+    {
+        storage_type* p = &ptr_;
+        state_.call_once([&]() {
+            *p = allocate_heap_pimpl<value_type>(p->get_deleter().get_allocator(), forward<Ts>(ts)...);
+        });
+    }
+
+    template <typename U>
+    void
+    assign(
+        U&& x
+    )
+    {
+        if (state_.constructed()) {
+            ref() = forward<U>(x);
+        } else {
+            construct(forward<U>(x));
+        }
+    }
+};
+
+// SPECIALIZATION
+// --------------
+
+// The construction state is a flag, or a lock-free atomic, neither
+// of which refer back to the address of the wrapper.
+
+template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+struct is_relocatable<lazy_stack_pimpl<T, Size, Alignment, ThreadSafe>>: is_relocatable<T>
+{};
+
+template <typename T, typename Allocator, bool ThreadSafe>
+struct is_relocatable<lazy_heap_pimpl<T, Allocator, ThreadSafe>>: is_relocatable<unique_heap_pimpl<T, Allocator>>
+{};
+
+// IMPLEMENTATION
+// --------------
+
+template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+const size_t lazy_stack_pimpl<T, Size, Alignment, ThreadSafe>::size;
+
+template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+const size_t lazy_stack_pimpl<T, Size, Alignment, ThreadSafe>::alignment;
+
+template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+const bool lazy_stack_pimpl<T, Size, Alignment, ThreadSafe>::thread_safe;
+
+template <typename T, typename Allocator, bool ThreadSafe>
+const bool lazy_heap_pimpl<T, Allocator, ThreadSafe>::thread_safe;
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,373 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Read-only singleton persisted to a memory-mapped file.
+ *
+ *  The `mapped_singleton` builds a read-only instance once, persists
+ *  it to a file, and on every later start maps the file read-only
+ *  instead of building the instance again. Every process mapping the
+ *  same file shares its pages through the page cache, so startup is a
+ *  single `mmap`, and the instance is only counted once in the memory
+ *  of the machine, rather than once per process.
+ *
+ *  The instance is used at whatever address the file is mapped, so the
+ *  type **must** be position-independent: trivially copyable, and
+ *  referring to its own data by offsets or indexes rather than by
+ *  pointers. The file records the size, alignment and a user-supplied
+ *  `Version` of the layout, and a file which does not match, for
+ *  example, after changing the type, is rebuilt.
+ *
+ *  The instance is built into a temporary file in the same directory,
+ *  which atomically replaces the file once complete, so concurrent
+ *  processes never map a partial instance. If the file can neither be
+ *  mapped nor created, or on platforms without `mmap`, the instance is
+ *  built in memory instead, without persisting it.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/mapped_singleton.h>
+ *
+ *      struct dictionary_data
+ *      {
+ *          uint32_t count;
+ *          uint32_t offsets[1 << 20];
+ *          char words[64 << 20];
+ *      };
+ *
+ *      using dictionary = mapped_singleton<dictionary_data, 1>;
+ *
+ *      const dictionary_data& d = dictionary::get("words.bin", [](dictionary_data& data) {
+ *          load_words("words.txt", data);
+ *      });
+ *
+ *  \synopsis
+ *      template <typename T, uint64_t Version = 0>
+ *      class mapped_singleton
+ *      {
+ *      public:
+ *          static constexpr uint64_t version = Version;
+ *          using value_type = T;
+ *
+ *          template <typename Function>
+ *          static const value_type& get(const char* path, Function build);
+ *          static const value_type& instance() noexcept;
+ *          static bool mapped() noexcept;
+ *          static void destroy() noexcept;
+ *      };
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/string.h>
+#include <pycpp/stl/type_traits.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define PYCPP_MAPPED_SINGLETON 1
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <stdio.h>
+#   include <unistd.h>
+#endif
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace mapped_detail
+{
+// DETAIL
+// ------
+
+/**
+ *  \brief Layout of the instance, stored at the start of the file.
+ */
+struct mapped_header
+{
+    uint64_t magic;
+    uint64_t size;
+    uint64_t alignment;
+    uint64_t version;
+};
+
+// "pycppmap"
+constexpr uint64_t mapped_magic = 0x70616d7070637970;
+
+constexpr
+size_t
+data_offset(
+    size_t alignment
+)
+noexcept
+{
+    return (sizeof(mapped_header) + alignment - 1) / alignment * alignment;
+}
+
+#if defined(PYCPP_MAPPED_SINGLETON)
+
+/**
+ *  \brief Read-only mapping of a file, or null.
+ */
+struct mapped_file
+{
+    void* address = nullptr;
+    size_t length = 0;
+};
+
+
+// Map an existing file, if it matches the expected layout.
+inline
+mapped_file
+map_existing(
+    const char* path,
+    const mapped_header& expected,
+    size_t length
+)
+noexcept
+{
+    mapped_file file;
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return file;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) == length) {
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            const mapped_header* header = static_cast<const mapped_header*>(p);
+            if (header->magic == expected.magic &&
+                header->size == expected.size &&
+                header->alignment == expected.alignment &&
+                header->version == expected.version)
+            {
+                file.address = p;
+                file.length = length;
+            } else {
+                ::munmap(p, length);
+            }
+        }
+    }
+    ::close(fd);
+    return file;
+}
+
+
+// Build the file in a temporary, and atomically replace `path`.
+// If the built file cannot be mapped read-only, the instance is
+// copied to `local`, so the caller does not build it again.
+template <typename T, typename Function>
+mapped_file
+map_new(
+    const char* path,
+    const mapped_header& expected,
+    size_t length,
+    Function& build,
+    unique_ptr<T>& local
+)
+{
+    mapped_file file;
+    string tmp = string(path) + ".tmp." + to_string(static_cast<long>(::getpid()));
+    int fd = ::open(tmp.data(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return file;
+    }
+
+    void* p = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(length)) == 0) {
+        p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        ::unlink(tmp.data());
+        return file;
+    }
+
+    T* data = reinterpret_cast<T*>(static_cast<char*>(p) + data_offset(alignof(T)));
+    void* q = MAP_FAILED;
+    try {
+        build(*::new (static_cast<void*>(data)) T());
+        *static_cast<mapped_header*>(p) = expected;
+        // map read-only before releasing the writable mapping, so the
+        // instance is still available if the mapping fails
+        q = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (q == MAP_FAILED) {
+            local.reset(new T(*data));
+        }
+    } catch (...) {
+        ::munmap(p, length);
+        ::close(fd);
+        ::unlink(tmp.data());
+        throw;
+    }
+    ::munmap(p, length);
+
+    // the read-only mapping still refers to the file after the rename,
+    // or to the unlinked temporary, which remains valid while mapped
+    bool persisted = ::fsync(fd) == 0 && ::rename(tmp.data(), path) == 0;
+    if (!persisted) {
+        ::unlink(tmp.data());
+    }
+    ::close(fd);
+    if (q != MAP_FAILED) {
+        file.address = q;
+        file.length = length;
+    }
+    return file;
+}
+
+#endif                                          // PYCPP_MAPPED_SINGLETON
+
+}   /* mapped_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Thread-safe read-only singleton mapped from a file.
+ */
+template <typename T, uint64_t Version = 0>
+class mapped_singleton
+{
+    static_assert(is_trivially_copyable<T>::value, "Mapped type must be trivially copyable.");
+
+public:
+    static constexpr uint64_t version = Version;
+    using value_type = T;
+
+    // Map the instance from `path`, or construct it with `build`,
+    // called with a value-initialized instance.
+    template <typename Function>
+    static
+    const value_type&
+    get(
+        const char* path,
+        Function build
+    )
+    {
+        const T* p = data_.load(memory_order_acquire);
+        if (p == nullptr) {
+            return init(path, build);
+        }
+        return *p;
+    }
+
+    static
+    const value_type&
+    instance()
+    noexcept
+    {
+        const T* p = data_.load(memory_order_acquire);
+        assert(p != nullptr && "Singleton accessed before initialization.");
+        return *p;
+    }
+
+    // Whether the instance is mapped from a file.
+    static
+    bool
+    mapped()
+    noexcept
+    {
+        return length_.load(memory_order_relaxed) != 0;
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        lock_guard<mutex> lock(mu_);
+        const T* p = data_.exchange(nullptr, memory_order_acq_rel);
+        if (p == nullptr) {
+            return;
+        }
+#if defined(PYCPP_MAPPED_SINGLETON)
+        size_t length = length_.exchange(0, memory_order_relaxed);
+        if (length != 0) {
+            const char* address = reinterpret_cast<const char*>(p) - offset;
+            ::munmap(const_cast<char*>(address), length);
+            return;
+        }
+#endif
+        delete p;
+    }
+
+private:
+    static constexpr size_t offset = mapped_detail::data_offset(alignof(T));
+
+    static atomic<const value_type*> data_;
+    static mutex mu_;
+    // length of the mapping, or 0 if built in memory, only written
+    // under `mu_`
+    static atomic<size_t> length_;
+
+    template <typename Function>
+    static
+    const value_type&
+    init(
+        const char* path,
+        Function& build
+    )
+    {
+        lock_guard<mutex> lock(mu_);
+        const T* p = data_.load(memory_order_relaxed);
+        if (p != nullptr) {
+            return *p;
+        }
+
+#if defined(PYCPP_MAPPED_SINGLETON)
+        using namespace mapped_detail;
+
+        mapped_header expected = {mapped_magic, sizeof(T), alignof(T), Version};
+        size_t length = offset + sizeof(T);
+        unique_ptr<T> local;
+        mapped_file file = map_existing(path, expected, length);
+        if (file.address == nullptr) {
+            file = map_new<T>(path, expected, length, build, local);
+        }
+        if (file.address != nullptr) {
+            p = reinterpret_cast<const T*>(static_cast<const char*>(file.address) + offset);
+            length_.store(file.length, memory_order_relaxed);
+            data_.store(p, memory_order_release);
+            return *p;
+        }
+#else
+        (void)path;
+        unique_ptr<T> local;
+#endif
+
+        if (!local) {
+            local.reset(new T());
+            build(*local);
+        }
+        p = local.release();
+        data_.store(p, memory_order_release);
+        return *p;
+    }
+};
+
+template <typename T, uint64_t Version>
+const uint64_t mapped_singleton<T, Version>::version;
+
+template <typename T, uint64_t Version>
+const size_t mapped_singleton<T, Version>::offset;
+
+template <typename T, uint64_t Version>
+atomic<const T*>
+mapped_singleton<T, Version>::data_ = ATOMIC_VAR_INIT(nullptr);
+
+template <typename T, uint64_t Version>
+mutex
+mapped_singleton<T, Version>::mu_;
+
+template <typename T, uint64_t Version>
+atomic<size_t>
+mapped_singleton<T, Version>::length_ = ATOMIC_VAR_INIT(0);
+
+PYCPP_END_NAMESPACE
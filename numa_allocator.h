@@ -0,0 +1,472 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief NUMA topology queries and a node-local allocator.
+ *
+ *  `numa_allocator` places its allocations on a single NUMA node, by
+ *  default the node of the thread constructing the allocator, so heap
+ *  PIMPL members accessed from one socket avoid remote-memory hits.
+ *  For example, as the `Allocator` of `unique_heap_pimpl`.
+ *
+ *  Allocations of at least a page are mapped directly and bound to
+ *  the node, with a preference which falls back to other nodes when
+ *  the node is out of memory. Freed mappings are kept in a small
+ *  process-wide cache, up to `numa_cache_count` mappings and
+ *  `numa_cache_bytes` bytes, and an allocation of the same size
+ *  reuses a cached mapping, moving its pages to the requested node if
+ *  needed, rather than mapping and faulting in new pages. Smaller
+ *  allocations share pages with
+ *  other objects, so they use the global `operator new`, which places
+ *  new pages on the node of the thread first touching them. On
+ *  platforms without NUMA support, every allocation uses `operator new`
+ *  and every thread runs on node 0.
+ *
+ *  The node of a thread may change whenever the scheduler migrates
+ *  it, so the current node is only a hint unless the thread is pinned.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/numa_allocator.h>
+ *
+ *      using table_impl = unique_heap_pimpl<table, numa_allocator<table>>;
+ *
+ *      table_impl local;                                   // current node
+ *      table_impl remote(numa_allocator<table>(1));        // node 1
+ *
+ *  \synopsis
+ *      constexpr size_t numa_cache_count = 16;
+ *      constexpr size_t numa_cache_bytes = 64 << 20;
+ *
+ *      size_t numa_node_count() noexcept;
+ *      size_t current_numa_node() noexcept;
+ *
+ *      template <typename T>
+ *      class numa_allocator
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using size_type = size_t;
+ *          using difference_type = ptrdiff_t;
+ *          using is_always_equal = true_type;
+ *
+ *          numa_allocator() noexcept;
+ *          numa_allocator(size_t node) noexcept;
+ *          template <typename U> numa_allocator(const numa_allocator<U>&) noexcept;
+ *
+ *          value_type* allocate(size_type n);
+ *          void deallocate(value_type* p, size_type n) noexcept;
+ *          size_t node() const noexcept;
+ *      };
+ *
+ *      template <typename T, typename U>
+ *      bool operator==(const numa_allocator<T>&, const numa_allocator<U>&) noexcept;
+ *
+ *      template <typename T, typename U>
+ *      bool operator!=(const numa_allocator<T>&, const numa_allocator<U>&) noexcept;
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/relocate.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/type_traits.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#   include <stdio.h>
+#   include <stdlib.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+PYCPP_BEGIN_NAMESPACE
+
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Maximum number and total size of cached freed mappings.
+ */
+constexpr size_t numa_cache_count = 16;
+constexpr size_t numa_cache_bytes = 64 << 20;
+
+namespace numa_detail
+{
+// DETAIL
+// ------
+
+#if defined(__linux__)
+
+// `MPOL_PREFERRED` and `MPOL_MF_MOVE`, without requiring the kernel
+// headers.
+constexpr int preferred_policy = 1;
+constexpr unsigned move_flag = 1 << 1;
+constexpr size_t max_nodes = 1024;
+constexpr size_t mask_bits = 8 * sizeof(unsigned long);
+
+inline
+size_t
+page_size()
+noexcept
+{
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+
+// Parse the highest node in a list such as "0-3,8".
+inline
+size_t
+read_node_count()
+noexcept
+{
+    FILE* file = fopen("/sys/devices/system/node/possible", "r");
+    if (file == nullptr) {
+        return 1;
+    }
+    char line[256];
+    char* str = fgets(line, sizeof(line), file);
+    fclose(file);
+    if (str == nullptr) {
+        return 1;
+    }
+
+    size_t count = 1;
+    while (*str != '\0') {
+        char* end;
+        unsigned long node = strtoul(str, &end, 10);
+        if (end == str) {
+            break;
+        }
+        if (node + 1 > count) {
+            count = node + 1;
+        }
+        str = *end == '\0' ? end : end + 1;
+    }
+    return count < max_nodes ? count : max_nodes;
+}
+
+
+// Prefer `node` for the pages of the mapping, optionally moving any
+// pages already on other nodes.
+inline
+void
+bind_to_node(
+    void* p,
+    size_t bytes,
+    size_t node,
+    unsigned flags
+)
+noexcept
+{
+#if defined(SYS_mbind)
+    // a failure, for example, without NUMA support in the kernel,
+    // leaves the default first-touch placement
+    unsigned long mask[max_nodes / mask_bits] = {};
+    if (node < max_nodes) {
+        mask[node / mask_bits] = 1UL << (node % mask_bits);
+        syscall(SYS_mbind, p, bytes, preferred_policy, mask, max_nodes + 1, flags);
+    }
+#else
+    (void)p;
+    (void)bytes;
+    (void)node;
+    (void)flags;
+#endif
+}
+
+
+/**
+ *  \brief Freed mappings, kept for reuse by allocations of the same size.
+ */
+class mapping_cache
+{
+public:
+    static
+    mapping_cache&
+    global()
+    noexcept
+    {
+        // never destroyed, so mappings freed by static destructors
+        // are still cached or released, and the cached mappings are
+        // released with the process
+        static mapping_cache* cache = new mapping_cache;
+        return *cache;
+    }
+
+    // Take a cached mapping of exactly `bytes`, or null.
+    void*
+    take(
+        size_t bytes
+    )
+    noexcept
+    {
+        lock_guard<mutex> lock(mu_);
+        for (size_t i = 0; i < count_; ++i) {
+            if (entries_[i].bytes == bytes) {
+                void* p = entries_[i].address;
+                entries_[i] = entries_[--count_];
+                total_ -= bytes;
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    // Cache the mapping, returning false if the cache is full.
+    bool
+    give(
+        void* p,
+        size_t bytes
+    )
+    noexcept
+    {
+        lock_guard<mutex> lock(mu_);
+        if (count_ == numa_cache_count || bytes > numa_cache_bytes - total_) {
+            return false;
+        }
+        entries_[count_++] = entry {p, bytes};
+        total_ += bytes;
+        return true;
+    }
+
+private:
+    struct entry
+    {
+        void* address;
+        size_t bytes;
+    };
+
+    mutex mu_;
+    entry entries_[numa_cache_count];
+    size_t count_ = 0;
+    size_t total_ = 0;
+
+    mapping_cache() = default;
+};
+
+
+inline
+void*
+map_on_node(
+    size_t bytes,
+    size_t node
+)
+{
+    void* p = mapping_cache::global().take(bytes);
+    if (p != nullptr) {
+        // the pages may be resident on the node of the previous
+        // allocation
+        bind_to_node(p, bytes, node, move_flag);
+        return p;
+    }
+
+    p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw bad_alloc();
+    }
+    bind_to_node(p, bytes, node, 0);
+    return p;
+}
+
+
+inline
+void
+unmap(
+    void* p,
+    size_t bytes
+)
+noexcept
+{
+    if (!mapping_cache::global().give(p, bytes)) {
+        munmap(p, bytes);
+    }
+}
+
+#endif                                          // __linux__
+
+}   /* numa_detail */
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Number of possible NUMA nodes, at least 1.
+ */
+inline
+size_t
+numa_node_count()
+noexcept
+{
+#if defined(__linux__)
+    static const size_t count = numa_detail::read_node_count();
+    return count;
+#else
+    return 1;
+#endif
+}
+
+
+/**
+ *  \brief NUMA node of the CPU currently running the calling thread.
+ */
+inline
+size_t
+current_numa_node()
+noexcept
+{
+#if defined(__linux__)
+    unsigned cpu;
+    unsigned node;
+#   if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    // uses the vDSO, avoiding a system call
+    if (getcpu(&cpu, &node) == 0) {
+        return node;
+    }
+#   elif defined(SYS_getcpu)
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return node;
+    }
+#   endif
+#endif
+    return 0;
+}
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Allocator placing memory on a single NUMA node.
+ */
+template <typename T>
+class numa_allocator
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    // memory from any node is freed the same way
+    using is_always_equal = true_type;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    numa_allocator()
+    noexcept:
+        node_(current_numa_node())
+    {}
+
+    numa_allocator(
+        size_t node
+    )
+    noexcept:
+        node_(node)
+    {}
+
+    numa_allocator(const numa_allocator&) noexcept = default;
+    numa_allocator& operator=(const numa_allocator&) noexcept = default;
+
+    template <typename U>
+    numa_allocator(
+        const numa_allocator<U>& x
+    )
+    noexcept:
+        node_(x.node())
+    {}
+
+    value_type*
+    allocate(
+        size_type n
+    )
+    {
+        size_t bytes = n * sizeof(value_type);
+#if defined(__linux__)
+        if (mapped(bytes)) {
+            return static_cast<value_type*>(numa_detail::map_on_node(bytes, node_));
+        }
+#endif
+        return static_cast<value_type*>(::operator new(bytes));
+    }
+
+    void
+    deallocate(
+        value_type* p,
+        size_type n
+    )
+    noexcept
+    {
+        size_t bytes = n * sizeof(value_type);
+#if defined(__linux__)
+        if (mapped(bytes)) {
+            numa_detail::unmap(static_cast<void*>(p), bytes);
+            return;
+        }
+#endif
+        (void)bytes;
+        ::operator delete(static_cast<void*>(p));
+    }
+
+    size_t
+    node()
+    const noexcept
+    {
+        return node_;
+    }
+
+private:
+    size_t node_;
+
+    static
+    bool
+    mapped(
+        size_t bytes
+    )
+    noexcept
+    {
+#if defined(__linux__)
+        return bytes >= numa_detail::page_size();
+#else
+        return false;
+#endif
+    }
+};
+
+
+template <typename T, typename U>
+inline
+bool
+operator==(
+    const numa_allocator<T>&,
+    const numa_allocator<U>&
+)
+noexcept
+{
+    return true;
+}
+
+
+template <typename T, typename U>
+inline
+bool
+operator!=(
+    const numa_allocator<T>& x,
+    const numa_allocator<U>& y
+)
+noexcept
+{
+    return !(x == y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T>
+struct is_relocatable<numa_allocator<T>>: true_type
+{};
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,223 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Singleton replicated on every NUMA node.
+ *
+ *  The `numa_singleton` keeps one instance per NUMA node, and each
+ *  access returns the replica of the node running the calling thread,
+ *  so read-mostly data, such as lookup tables, is always read from
+ *  local memory. Each replica is constructed by the first thread
+ *  accessing it from its node, from the arguments of that access, in
+ *  memory from `numa_allocator` bound to the node, so members it
+ *  allocates while constructing are also placed on the node.
+ *
+ *  Replicas are independent instances, so any update must be applied
+ *  to every replica, for example, with `for_each_replica`, and readers
+ *  may observe the replicas in different states. Nodes beyond
+ *  `MaxNodes` share replicas, each placed on the node of the thread
+ *  constructing it. As with the other heap singletons, the
+ *  replicas are never destroyed implicitly, and `destroy` must not
+ *  run concurrently with any other access.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/numa_singleton.h>
+ *
+ *      struct dictionary: numa_singleton<dictionary>
+ *      {
+ *          dictionary(const char* path);
+ *      };
+ *
+ *      void lookup()
+ *      {
+ *          dictionary& d = dictionary::get("words.txt");   // local replica
+ *      }
+ *
+ *  \synopsis
+ *      template <typename T, size_t MaxNodes = 8>
+ *      class numa_singleton
+ *      {
+ *      public:
+ *          static constexpr size_t max_nodes = MaxNodes;
+ *          using value_type = T;
+ *
+ *          template<typename ... Ts>
+ *          static value_type& get(Ts&&... ts);
+ *          template<typename ... Ts>
+ *          static value_type& init(Ts&&... ts);
+ *          static value_type* replica(size_t node) noexcept;
+ *          static size_t replica_index() noexcept;
+ *
+ *          template <typename Function>
+ *          static void for_each_replica(Function f);
+ *          static void destroy() noexcept;
+ *
+ *      protected:
+ *          numa_singleton() = default;
+ *          numa_singleton(const numa_singleton&) = delete;
+ *          numa_singleton& operator=(const numa_singleton&) = delete;
+ *          ~numa_singleton();
+ *      };
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/numa_allocator.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Thread-safe heap singleton with one instance per NUMA node.
+ */
+template <typename T, size_t MaxNodes = 8>
+class numa_singleton
+{
+public:
+    static_assert(MaxNodes > 0, "Must have at least one replica.");
+
+    static constexpr size_t max_nodes = MaxNodes;
+    using value_type = T;
+
+    template<typename ... Ts>
+    static
+    value_type&
+    get(
+        Ts&&... ts
+    )
+    {
+        T* p = data_[replica_index()].load(memory_order_acquire);
+        if (p == nullptr) {
+            return init(forward<Ts>(ts)...);
+        }
+        return *p;
+    }
+
+    // Construct the replica of the current node.
+    template<typename ... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+        // bind to the actual node, which may exceed the replicas
+        size_t node = current_numa_node();
+        size_t index = node % MaxNodes;
+        lock_guard<mutex> lock(mu_[index]);
+        T* p = data_[index].load(memory_order_relaxed);
+        if (p == nullptr) {
+            numa_allocator<T> alloc(node);
+            p = alloc.allocate(1);
+            managed_ = true;
+            try {
+                ::new (static_cast<void*>(p)) T(forward<Ts>(ts)...);
+            } catch (...) {
+                managed_ = false;
+                alloc.deallocate(p, 1);
+                throw;
+            }
+            managed_ = false;
+            data_[index].store(p, memory_order_release);
+        }
+        return *p;
+    }
+
+    // Replica at index `node`, or null if it is not constructed.
+    static
+    value_type*
+    replica(
+        size_t node
+    )
+    noexcept
+    {
+        assert(node < MaxNodes);
+        return data_[node].load(memory_order_acquire);
+    }
+
+    static
+    size_t
+    replica_index()
+    noexcept
+    {
+        return current_numa_node() % MaxNodes;
+    }
+
+    // Call `f` with every constructed replica.
+    template <typename Function>
+    static
+    void
+    for_each_replica(
+        Function f
+    )
+    {
+        for (size_t i = 0; i < MaxNodes; ++i) {
+            T* p = data_[i].load(memory_order_acquire);
+            if (p != nullptr) {
+                f(*p);
+            }
+        }
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        for (size_t i = 0; i < MaxNodes; ++i) {
+            lock_guard<mutex> lock(mu_[i]);
+            // use temporary to avoid recursion
+            value_type* tmp = data_[i].exchange(nullptr, memory_order_acq_rel);
+            if (tmp != nullptr) {
+                managed_ = true;
+                tmp->~T();
+                managed_ = false;
+                numa_allocator<T>(i).deallocate(tmp, 1);
+            }
+        }
+    }
+
+protected:
+    numa_singleton() = default;
+    numa_singleton(const numa_singleton&) = delete;
+    numa_singleton& operator=(const numa_singleton&) = delete;
+
+    ~numa_singleton()
+    {
+#ifndef NDEBUG
+        assert(managed_ && "Singleton used outside of pattern.");
+#endif
+    }
+
+private:
+    static atomic<value_type*> data_[MaxNodes];
+    static mutex mu_[MaxNodes];
+    // whether the pattern is constructing or destroying a replica on
+    // the calling thread, since replicas are constructed concurrently
+    static thread_local bool managed_;
+};
+
+template <typename T, size_t MaxNodes>
+const size_t numa_singleton<T, MaxNodes>::max_nodes;
+
+template <typename T, size_t MaxNodes>
+atomic<T*>
+numa_singleton<T, MaxNodes>::data_[MaxNodes] = {};
+
+template <typename T, size_t MaxNodes>
+mutex
+numa_singleton<T, MaxNodes>::mu_[MaxNodes];
+
+template <typename T, size_t MaxNodes>
+thread_local bool
+numa_singleton<T, MaxNodes>::managed_ = false;
+
+PYCPP_END_NAMESPACE
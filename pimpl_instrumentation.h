@@ -0,0 +1,389 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Optional allocation instrumentation for heap PIMPL wrappers.
+ *
+ *  When `USE_PIMPL_INSTRUMENTATION` is defined, the heap PIMPL
+ *  wrappers record, per implied type, the number of allocations and
+ *  deallocations, the total bytes allocated, and the number of copies
+ *  and moves of the wrapper. `pimpl_snapshot` returns the statistics
+ *  for every type recorded so far. The counters are relaxed atomics
+ *  in a lock-free registry, so recording never blocks.
+ *
+ *  When undefined, every hook is an empty inline function and
+ *  `pimpl_snapshot` returns no statistics, so the wrappers compile
+ *  to the same code as without instrumentation. The macro changes
+ *  the layout of `shared_heap_pimpl` allocations and the deleter of
+ *  `unique_heap_pimpl`, and therefore must be consistent across
+ *  every translation unit.
+ *
+ *  Bytes allocated by `shared_heap_pimpl` include the `shared_ptr`
+ *  control block. The type name is extracted from the compiler's
+ *  signature of a function template instantiated with the type,
+ *  which does not require RTTI, and is spelled as the compiler
+ *  prints it.
+ *
+ *  \synopsis
+ *      struct pimpl_statistics
+ *      {
+ *          const char* name;
+ *          size_t allocations;
+ *          size_t deallocations;
+ *          size_t bytes;
+ *          size_t copies;
+ *          size_t moves;
+ *          size_t live;
+ *      };
+ *
+ *      template <typename T> void pimpl_record_allocation(size_t bytes) noexcept;
+ *      template <typename T> void pimpl_record_deallocation() noexcept;
+ *      template <typename T> void pimpl_record_copy() noexcept;
+ *      template <typename T> void pimpl_record_move() noexcept;
+ *
+ *      vector<pimpl_statistics> pimpl_snapshot();
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstring.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/vector.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Snapshot of the counters for a single implied type.
+ */
+struct pimpl_statistics
+{
+    const char* name;
+    size_t allocations;
+    size_t deallocations;
+    size_t bytes;
+    size_t copies;
+    size_t moves;
+    size_t live;
+};
+
+namespace instrument_detail
+{
+// DETAIL
+// ------
+
+// Uses the function signature, which does not require RTTI or a
+// complete type, since the copy and move hooks may be instantiated
+// with an incomplete type.
+template <typename T>
+inline
+const char*
+signature()
+noexcept
+{
+#if defined(_MSC_VER)
+    return __FUNCSIG__;
+#else
+    return __PRETTY_FUNCTION__;
+#endif
+}
+
+
+// Extract the type from the signature, for example, `foo` from
+// `const char* signature() [with T = foo]`, or the whole signature
+// if it has an unexpected format. The name is never freed.
+inline
+const char*
+trim_signature(
+    const char* s
+)
+noexcept
+{
+#if defined(_MSC_VER)
+    const char* prefix = "signature<";
+    const char* suffix = ">(void)";
+#else
+    const char* prefix = "T = ";
+    const char* suffix = "]";
+#endif
+    const char* first = strstr(s, prefix);
+    if (first == nullptr) {
+        return s;
+    }
+    first += strlen(prefix);
+
+    const char* last = nullptr;
+    for (const char* p = strstr(first, suffix); p != nullptr; p = strstr(p + 1, suffix)) {
+        last = p;
+    }
+    if (last == nullptr) {
+        return s;
+    }
+
+    size_t length = static_cast<size_t>(last - first);
+    char* name = new (nothrow) char[length + 1];
+    if (name == nullptr) {
+        return s;
+    }
+    memcpy(name, first, length);
+    name[length] = '\0';
+    return name;
+}
+
+
+template <typename T>
+inline
+const char*
+type_name()
+noexcept
+{
+    static const char* name = trim_signature(signature<T>());
+    return name;
+}
+
+}   /* instrument_detail */
+
+#if defined(USE_PIMPL_INSTRUMENTATION)
+
+namespace instrument_detail
+{
+// DETAIL
+// ------
+
+struct pimpl_counters;
+
+inline
+atomic<pimpl_counters*>&
+registry()
+noexcept
+{
+    static atomic<pimpl_counters*> head(nullptr);
+    return head;
+}
+
+
+struct pimpl_counters
+{
+    const char* name;
+    atomic<size_t> allocations;
+    atomic<size_t> deallocations;
+    atomic<size_t> bytes;
+    atomic<size_t> copies;
+    atomic<size_t> moves;
+    pimpl_counters* next;
+
+    pimpl_counters(
+        const char* n
+    )
+    noexcept:
+        name(n),
+        allocations(0),
+        deallocations(0),
+        bytes(0),
+        copies(0),
+        moves(0),
+        next(nullptr)
+    {
+        // counters are never removed, so pushing is ABA-safe
+        atomic<pimpl_counters*>& head = registry();
+        next = head.load(memory_order_relaxed);
+        while (!head.compare_exchange_weak(next, this, memory_order_release, memory_order_relaxed))
+        {}
+    }
+};
+
+
+template <typename T>
+inline
+pimpl_counters&
+counters()
+noexcept
+{
+    static pimpl_counters c(type_name<T>());
+    return c;
+}
+
+
+/**
+ *  \brief Allocator recording every allocation under the type `Tag`.
+ */
+template <typename U, typename Tag, typename Upstream>
+class counting_allocator
+{
+public:
+    using value_type = U;
+    using upstream_type = typename allocator_traits<Upstream>::template rebind_alloc<U>;
+    using propagate_on_container_copy_assignment = typename allocator_traits<upstream_type>::propagate_on_container_copy_assignment;
+    using propagate_on_container_move_assignment = typename allocator_traits<upstream_type>::propagate_on_container_move_assignment;
+    using propagate_on_container_swap = typename allocator_traits<upstream_type>::propagate_on_container_swap;
+    using is_always_equal = typename allocator_traits<upstream_type>::is_always_equal;
+
+    template <typename V>
+    struct rebind
+    {
+        using other = counting_allocator<V, Tag, Upstream>;
+    };
+
+    counting_allocator() = default;
+
+    counting_allocator(
+        const Upstream& alloc
+    ):
+        upstream_(alloc)
+    {}
+
+    template <typename V>
+    counting_allocator(
+        const counting_allocator<V, Tag, Upstream>& x
+    ):
+        upstream_(x.upstream())
+    {}
+
+    U*
+    allocate(
+        size_t n
+    )
+    {
+        U* p = allocator_traits<upstream_type>::allocate(upstream_, n);
+        pimpl_counters& c = counters<Tag>();
+        c.allocations.fetch_add(1, memory_order_relaxed);
+        c.bytes.fetch_add(n * sizeof(U), memory_order_relaxed);
+        return p;
+    }
+
+    void
+    deallocate(
+        U* p,
+        size_t n
+    )
+    noexcept
+    {
+        counters<Tag>().deallocations.fetch_add(1, memory_order_relaxed);
+        allocator_traits<upstream_type>::deallocate(upstream_, p, n);
+    }
+
+    const upstream_type&
+    upstream()
+    const noexcept
+    {
+        return upstream_;
+    }
+
+    template <typename V>
+    bool
+    operator==(
+        const counting_allocator<V, Tag, Upstream>& x
+    )
+    const noexcept
+    {
+        return upstream_ == upstream_type(x.upstream());
+    }
+
+    template <typename V>
+    bool
+    operator!=(
+        const counting_allocator<V, Tag, Upstream>& x
+    )
+    const noexcept
+    {
+        return !operator==(x);
+    }
+
+private:
+    upstream_type upstream_;
+};
+
+}   /* instrument_detail */
+
+#endif                                          // USE_PIMPL_INSTRUMENTATION
+
+// FUNCTIONS
+// ---------
+
+template <typename T>
+inline
+void
+pimpl_record_allocation(
+    size_t bytes
+)
+noexcept
+{
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    instrument_detail::pimpl_counters& c = instrument_detail::counters<T>();
+    c.allocations.fetch_add(1, memory_order_relaxed);
+    c.bytes.fetch_add(bytes, memory_order_relaxed);
+#else
+    (void) bytes;
+#endif
+}
+
+
+template <typename T>
+inline
+void
+pimpl_record_deallocation()
+noexcept
+{
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    instrument_detail::counters<T>().deallocations.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+
+template <typename T>
+inline
+void
+pimpl_record_copy()
+noexcept
+{
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    instrument_detail::counters<T>().copies.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+
+template <typename T>
+inline
+void
+pimpl_record_move()
+noexcept
+{
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    instrument_detail::counters<T>().moves.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+
+/**
+ *  \brief Get the current statistics for every instrumented type.
+ */
+inline
+vector<pimpl_statistics>
+pimpl_snapshot()
+{
+    vector<pimpl_statistics> v;
+#if defined(USE_PIMPL_INSTRUMENTATION)
+    using instrument_detail::pimpl_counters;
+    pimpl_counters* c = instrument_detail::registry().load(memory_order_acquire);
+    for (; c != nullptr; c = c->next) {
+        pimpl_statistics s;
+        s.name = c->name;
+        s.allocations = c->allocations.load(memory_order_relaxed);
+        s.deallocations = c->deallocations.load(memory_order_relaxed);
+        s.bytes = c->bytes.load(memory_order_relaxed);
+        s.copies = c->copies.load(memory_order_relaxed);
+        s.moves = c->moves.load(memory_order_relaxed);
+        s.live = s.allocations - s.deallocations;
+        v.push_back(s);
+    }
+#endif
+    return v;
+}
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,82 @@
+#  :copyright: (c) 2017-2018 Alex Huszagh.
+#  :license: MIT, see licenses/mit.md for more details.
+#
+#  Generate the exact size and alignment of PIMPL implementation types
+#  for the target platform, for use as the `Size` and `Alignment` of
+#  `stack_pimpl`, `lazy_stack_pimpl` and `stack_singleton`.
+#
+#  The values are measured with `check_type_size`, which compiles each
+#  probe without running it, so it also works when cross-compiling. The
+#  probes are re-run whenever one of the headers changes.
+#
+#  Usage:
+#
+#      pimpl_sizes(
+#          OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/file_sizes.h
+#          HEADERS src/file_impl.h
+#          INCLUDE_DIRECTORIES ${CMAKE_CURRENT_SOURCE_DIR}/src
+#          TYPES file_impl=FILE_IMPL detail::socket_impl=SOCKET_IMPL
+#      )
+#
+#  Generates:
+#
+#      #define FILE_IMPL_SIZE 48
+#      #define FILE_IMPL_ALIGNMENT 8
+#      ...
+
+include(CheckTypeSize)
+
+function(pimpl_sizes)
+    cmake_parse_arguments(PIMPL "" "OUTPUT" "HEADERS;INCLUDE_DIRECTORIES;DEFINITIONS;TYPES" ${ARGN})
+    if(NOT PIMPL_OUTPUT)
+        message(FATAL_ERROR "pimpl_sizes: OUTPUT is required.")
+    endif()
+
+    set(CMAKE_EXTRA_INCLUDE_FILES)
+    foreach(header ${PIMPL_HEADERS})
+        get_filename_component(path "${header}" ABSOLUTE)
+        list(APPEND CMAKE_EXTRA_INCLUDE_FILES "${path}")
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${path}")
+    endforeach()
+    set(CMAKE_REQUIRED_INCLUDES ${PIMPL_INCLUDE_DIRECTORIES})
+    set(CMAKE_REQUIRED_DEFINITIONS ${PIMPL_DEFINITIONS})
+    set(CMAKE_REQUIRED_QUIET ON)
+
+    set(content "// Generated by pimpl_sizes, do not edit.\n\n#pragma once\n")
+    foreach(entry ${PIMPL_TYPES})
+        string(REPLACE "=" ";" pair "${entry}")
+        list(LENGTH pair length)
+        if(NOT length EQUAL 2)
+            message(FATAL_ERROR "pimpl_sizes: expected TYPE=PREFIX, got \"${entry}\".")
+        endif()
+        list(GET pair 0 type)
+        list(GET pair 1 prefix)
+
+        # the results are cached, so clear them to measure the current layout
+        set(size_var PIMPL_SIZEOF_${prefix})
+        set(align_var PIMPL_ALIGNOF_${prefix})
+        unset(${size_var} CACHE)
+        unset(HAVE_${size_var} CACHE)
+        unset(${align_var} CACHE)
+        unset(HAVE_${align_var} CACHE)
+
+        check_type_size("${type}" ${size_var} LANGUAGE CXX)
+        check_type_size("char[alignof(${type})]" ${align_var} LANGUAGE CXX)
+        if(NOT HAVE_${size_var} OR NOT HAVE_${align_var})
+            message(FATAL_ERROR "pimpl_sizes: cannot determine the layout of \"${type}\".")
+        endif()
+
+        string(APPEND content
+            "\n#define ${prefix}_SIZE ${${size_var}}"
+            "\n#define ${prefix}_ALIGNMENT ${${align_var}}\n"
+        )
+    endforeach()
+
+    # only touch the output if the layout changed, to avoid rebuilds
+    if(EXISTS "${PIMPL_OUTPUT}")
+        file(READ "${PIMPL_OUTPUT}" previous)
+    endif()
+    if(NOT "${previous}" STREQUAL "${content}")
+        file(WRITE "${PIMPL_OUTPUT}" "${content}")
+    endif()
+endfunction()
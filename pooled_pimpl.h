@@ -0,0 +1,568 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief PIMPL idiom re-using constructed members from a per-thread pool.
+ *
+ *  For implied classes which are expensive to construct, for example,
+ *  owning large buffers, `pooled_pimpl` never destroys the member on
+ *  destruction, but returns it to a pool owned by the thread which
+ *  created it, and construction takes a member from the calling
+ *  thread's pool, only allocating and constructing a new member when
+ *  the pool is empty. This removes both the allocation and the
+ *  constructor from the steady state.
+ *
+ *  Before returning a member to the pool, its `reset()` member
+ *  function, if any, is called to clear any state, while keeping the
+ *  capacity of its buffers. `reset` must not throw. Returning a member
+ *  from the owning thread is a push onto a local free list, while
+ *  other threads push onto a lock-free multiple-producer queue, which
+ *  the owner drains when its free list is empty. At most `Capacity`
+ *  members are kept per thread, and any others are destroyed.
+ *
+ *  When a thread exits, its pool destroys every pooled member, and
+ *  members still in use are destroyed when they are returned, by the
+ *  thread returning them. Members created or returned after the pool
+ *  of the thread was destroyed, for example, by a later-destroyed
+ *  `thread_local`, bypass the pool, and are allocated and destroyed
+ *  individually.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/pooled_pimpl.h>
+ *
+ *      struct request_impl
+ *      {
+ *          vector<char> buffer;
+ *          void reset() { buffer.clear(); }
+ *      };
+ *
+ *      struct request
+ *      {
+ *      private:
+ *          pooled_pimpl<request_impl> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      template <typename T, size_t Capacity = 64>
+ *      class pooled_pimpl
+ *      {
+ *      public:
+ *          static constexpr size_t capacity = Capacity;
+ *
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *
+ *          pooled_pimpl();
+ *          pooled_pimpl(const pooled_pimpl& x);
+ *          pooled_pimpl& operator=(const pooled_pimpl& x);
+ *          pooled_pimpl(pooled_pimpl&& x) noexcept;
+ *          pooled_pimpl& operator=(pooled_pimpl&& x) noexcept;
+ *          ~pooled_pimpl();
+ *
+ *          reference operator*() noexcept;
+ *          const_reference operator*() const noexcept;
+ *          pointer operator->() noexcept;
+ *          const_pointer operator->() const noexcept;
+ *          operator reference() noexcept;
+ *          operator const_reference() const noexcept;
+ *          reference get() noexcept;
+ *          const_reference get() const noexcept;
+ *
+ *          void swap(pooled_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename T, size_t Capacity>
+ *      struct is_relocatable<pooled_pimpl<T, Capacity>>;
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/relocate.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace pool_detail
+{
+// DETAIL
+// ------
+
+template <typename T>
+inline
+auto
+reset(
+    T& t,
+    int
+)
+noexcept
+-> decltype(t.reset(), void())
+{
+    t.reset();
+}
+
+
+template <typename T>
+inline
+void
+reset(
+    T&,
+    long
+)
+noexcept
+{}
+
+
+template <typename T, size_t Capacity>
+class local_pool;
+
+
+template <typename T, size_t Capacity>
+struct pool_node
+{
+    T value;
+    pool_node* next;
+    local_pool<T, Capacity>* owner;
+
+    pool_node(
+        local_pool<T, Capacity>* o
+    ):
+        value(),
+        next(nullptr),
+        owner(o)
+    {}
+};
+
+
+/**
+ *  \brief Free members of a single thread.
+ *
+ *  The pool is reference counted by the members in use, plus one for
+ *  the owning thread, so it outlives every member returned after the
+ *  thread exits.
+ */
+template <typename T, size_t Capacity>
+class local_pool
+{
+public:
+    using node = pool_node<T, Capacity>;
+
+    local_pool(const local_pool&) = delete;
+    local_pool& operator=(const local_pool&) = delete;
+
+    // Pool of the calling thread, or null if it has none.
+    static
+    local_pool*
+    current()
+    noexcept
+    {
+        return slot();
+    }
+
+    // Take a member from the calling thread's pool, creating the
+    // pool if needed.
+    static
+    node*
+    take()
+    {
+        local_pool* pool = slot();
+        if (pool != nullptr) {
+            return pool->acquire();
+        }
+
+        pool = new local_pool;
+        if (exited()) {
+            // the holder is destroyed, so use a closed pool owned
+            // only by the member, which destroys it once returned
+            node* n;
+            try {
+                n = pool->acquire();
+            } catch (...) {
+                pool->close();
+                throw;
+            }
+            pool->close();
+            return n;
+        }
+        slot() = pool;
+        static thread_local pool_holder h;
+        (void)h;
+        return pool->acquire();
+    }
+
+    ~local_pool()
+    {
+        if (inbox_.load(memory_order_relaxed) != closed()) {
+            destroy_list(inbox_.load(memory_order_acquire));
+        }
+        destroy_list(free_);
+    }
+
+    node*
+    acquire()
+    {
+        if (free_ == nullptr) {
+            drain();
+        }
+        node* n = free_;
+        if (n != nullptr) {
+            free_ = n->next;
+            --size_;
+        } else {
+            n = new node(this);
+        }
+        refs_.fetch_add(1, memory_order_relaxed);
+        return n;
+    }
+
+    // Must be called from the owning thread.
+    void
+    release_local(
+        node* n
+    )
+    noexcept
+    {
+        // the pool may have been closed while the member was in use
+        if (inbox_.load(memory_order_relaxed) == closed()) {
+            delete n;
+        } else {
+            push_free(n);
+        }
+        unref();
+    }
+
+    void
+    release_remote(
+        node* n
+    )
+    noexcept
+    {
+        node* head = inbox_.load(memory_order_relaxed);
+        do {
+            if (head == closed()) {
+                delete n;
+                break;
+            }
+            n->next = head;
+        } while (!inbox_.compare_exchange_weak(head, n, memory_order_release, memory_order_relaxed));
+        unref();
+    }
+
+private:
+    // Closes the pool on thread exit.
+    struct pool_holder
+    {
+        ~pool_holder()
+        {
+            local_pool* pool = slot();
+            slot() = nullptr;
+            exited() = true;
+            if (pool != nullptr) {
+                pool->close();
+            }
+        }
+    };
+
+    node* free_ = nullptr;
+    size_t size_ = 0;
+    atomic<node*> inbox_;
+    atomic<size_t> refs_;
+
+    local_pool()
+    noexcept:
+        inbox_(nullptr),
+        refs_(1)
+    {}
+
+    // Both are trivially destructible, so they remain valid after
+    // the holder is destroyed on thread exit.
+    static
+    local_pool*&
+    slot()
+    noexcept
+    {
+        static thread_local local_pool* pool = nullptr;
+        return pool;
+    }
+
+    static
+    bool&
+    exited()
+    noexcept
+    {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    // Marks the inbox once the owner exits, so later returns destroy
+    // the member.
+    static
+    node*
+    closed()
+    noexcept
+    {
+        return reinterpret_cast<node*>(static_cast<uintptr_t>(1));
+    }
+
+    void
+    push_free(
+        node* n
+    )
+    noexcept
+    {
+        if (size_ < Capacity) {
+            n->next = free_;
+            free_ = n;
+            ++size_;
+        } else {
+            delete n;
+        }
+    }
+
+    // Only the owner takes from the inbox, and it takes every node
+    // at once, so the queue is free of ABA.
+    void
+    drain()
+    noexcept
+    {
+        node* n = inbox_.exchange(nullptr, memory_order_acquire);
+        while (n != nullptr) {
+            node* next = n->next;
+            push_free(n);
+            n = next;
+        }
+    }
+
+    void
+    close()
+    noexcept
+    {
+        node* n = inbox_.exchange(closed(), memory_order_acquire);
+        destroy_list(n);
+        destroy_list(free_);
+        free_ = nullptr;
+        size_ = 0;
+        unref();
+    }
+
+    void
+    unref()
+    noexcept
+    {
+        if (refs_.fetch_sub(1, memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    static
+    void
+    destroy_list(
+        node* n
+    )
+    noexcept
+    {
+        while (n != nullptr) {
+            node* next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+};
+
+}   /* pool_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief PIMPL idiom over members pooled by thread.
+ */
+template <typename T, size_t Capacity = 64>
+class pooled_pimpl
+{
+    using pool_type = pool_detail::local_pool<T, Capacity>;
+    using node = typename pool_type::node;
+
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t capacity = Capacity;
+
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    pooled_pimpl():
+        node_(pool_type::take())
+    {}
+
+    pooled_pimpl(
+        const pooled_pimpl& x
+    ):
+        pooled_pimpl()
+    {
+        get() = x.get();
+    }
+
+    pooled_pimpl&
+    operator=(
+        const pooled_pimpl& x
+    )
+    {
+        if (this != &x) {
+            if (node_ == nullptr) {
+                node_ = pool_type::take();
+            }
+            get() = x.get();
+        }
+        return *this;
+    }
+
+    // The source is left without a member, and may only be
+    // assigned to or destroyed.
+    pooled_pimpl(
+        pooled_pimpl&& x
+    )
+    noexcept:
+        node_(x.node_)
+    {
+        x.node_ = nullptr;
+    }
+
+    pooled_pimpl&
+    operator=(
+        pooled_pimpl&& x
+    )
+    noexcept
+    {
+        if (this != &x) {
+            release();
+            node_ = x.node_;
+            x.node_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~pooled_pimpl()
+    {
+        release();
+    }
+
+    // CONVERSIONS
+    reference
+    operator*()
+    noexcept
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const noexcept
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    noexcept
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const noexcept
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    noexcept
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const noexcept
+    {
+        return get();
+    }
+
+    reference
+    get()
+    noexcept
+    {
+        assert(node_ != nullptr && "Accessing a moved-from pooled_pimpl.");
+        return node_->value;
+    }
+
+    const_reference
+    get()
+    const noexcept
+    {
+        assert(node_ != nullptr && "Accessing a moved-from pooled_pimpl.");
+        return node_->value;
+    }
+
+    // MODIFIERS
+    void
+    swap(
+        pooled_pimpl& x
+    )
+    noexcept
+    {
+        fast_swap(node_, x.node_);
+    }
+
+private:
+    node* node_;
+
+    void
+    release()
+    noexcept
+    {
+        if (node_ == nullptr) {
+            return;
+        }
+        pool_detail::reset(node_->value, 0);
+        pool_type* owner = node_->owner;
+        if (owner == pool_type::current()) {
+            owner->release_local(node_);
+        } else {
+            owner->release_remote(node_);
+        }
+        node_ = nullptr;
+    }
+};
+
+// SPECIALIZATION
+// --------------
+
+template <typename T, size_t Capacity>
+struct is_relocatable<pooled_pimpl<T, Capacity>>: true_type
+{};
+
+// IMPLEMENTATION
+// --------------
+
+template <typename T, size_t Capacity>
+const size_t pooled_pimpl<T, Capacity>::capacity;
+
+PYCPP_END_NAMESPACE
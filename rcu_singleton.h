@@ -0,0 +1,430 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Read-mostly singleton replaceable at runtime.
+ *
+ *  The `rcu_singleton` holds the current version of a shared instance,
+ *  which readers access through a `read_guard` snapshot, while writers
+ *  publish new versions atomically. Old versions are reclaimed once
+ *  every reader which may still access them has finished, using
+ *  epoch-based reclamation: each thread announces the epoch it started
+ *  reading in, in a record padded to its own cache line, so readers
+ *  never write to shared memory or contend on a reference count.
+ *
+ *  Readers see an immutable snapshot, which stays valid for the
+ *  lifetime of the guard, even if a new version is published in the
+ *  meantime. Guards may be nested, and should be short-lived, since a
+ *  long-lived guard delays the reclamation of every later version.
+ *
+ *  Writers are serialized by a mutex. `publish` constructs a new
+ *  version, `update` copies the current version and modifies the copy
+ *  before publishing it, and `synchronize` waits until every retired
+ *  version is reclaimed. Unlike the other singletons, new versions
+ *  are created by the writers, so the type does not derive from the
+ *  singleton, and the current version is never destroyed implicitly.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/rcu_singleton.h>
+ *
+ *      using routes = rcu_singleton<routing_table>;
+ *
+ *      void reader()
+ *      {
+ *          auto table = routes::read();
+ *          table->lookup(...);
+ *      }
+ *
+ *      void writer()
+ *      {
+ *          routes::update([](routing_table& t) { t.add(...); });
+ *      }
+ *
+ *  \synopsis
+ *      template <typename T>
+ *      class rcu_singleton
+ *      {
+ *      public:
+ *          using value_type = T;
+ *
+ *          class read_guard
+ *          {
+ *          public:
+ *              read_guard(read_guard&& x) noexcept;
+ *              read_guard(const read_guard&) = delete;
+ *              read_guard& operator=(const read_guard&) = delete;
+ *              ~read_guard();
+ *
+ *              const value_type& operator*() const noexcept;
+ *              const value_type* operator->() const noexcept;
+ *              const value_type& get() const noexcept;
+ *          };
+ *
+ *          static read_guard read();
+ *          static bool initialized() noexcept;
+ *
+ *          template <typename ... Ts>
+ *          static void init(Ts&&... ts);
+ *          template <typename ... Ts>
+ *          static void publish(Ts&&... ts);
+ *          template <typename Function>
+ *          static void update(Function f);
+ *
+ *          static void synchronize();
+ *          static void destroy();
+ *      };
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/stack_pimpl.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/thread.h>
+#include <pycpp/stl/utility.h>
+#include <pycpp/stl/vector.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace rcu_detail
+{
+// DETAIL
+// ------
+
+/**
+ *  \brief Epoch announced by a reading thread, or 0 while quiescent.
+ *
+ *  Records are never freed, and are re-used once their thread exits.
+ *  The padding keeps the epochs of separately allocated records on
+ *  different cache lines, without requiring over-aligned `new`.
+ */
+struct rcu_record
+{
+    atomic<uint64_t> epoch;
+    atomic<bool> in_use;
+    size_t depth;
+    rcu_record* next;
+    char padding[cache_line_size];
+
+    rcu_record() noexcept:
+        epoch(0),
+        in_use(true),
+        depth(0),
+        next(nullptr)
+    {}
+};
+
+}   /* rcu_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Singleton with snapshot reads and epoch-based reclamation.
+ */
+template <typename T>
+class rcu_singleton
+{
+    using record = rcu_detail::rcu_record;
+
+public:
+    using value_type = T;
+
+    /**
+     *  \brief Snapshot of the current version.
+     */
+    class read_guard
+    {
+    public:
+        read_guard(
+            read_guard&& x
+        )
+        noexcept:
+            record_(x.record_),
+            ptr_(x.ptr_)
+        {
+            x.record_ = nullptr;
+        }
+
+        read_guard(const read_guard&) = delete;
+        read_guard& operator=(const read_guard&) = delete;
+
+        ~read_guard()
+        {
+            if (record_ != nullptr && --record_->depth == 0) {
+                record_->epoch.store(0, memory_order_release);
+            }
+        }
+
+        const value_type&
+        operator*()
+        const noexcept
+        {
+            return get();
+        }
+
+        const value_type*
+        operator->()
+        const noexcept
+        {
+            return &get();
+        }
+
+        const value_type&
+        get()
+        const noexcept
+        {
+            return *ptr_;
+        }
+
+    private:
+        friend class rcu_singleton;
+
+        record* record_;
+        const value_type* ptr_;
+
+        read_guard(
+            record* r
+        )
+        noexcept:
+            record_(r)
+        {
+            // the announcement and the load must be sequentially
+            // consistent, so either the writer scanning the records
+            // sees the announcement, or this load sees the version
+            // published before the scan
+            if (record_->depth++ == 0) {
+                record_->epoch.store(epoch_.load(memory_order_acquire), memory_order_seq_cst);
+            }
+            ptr_ = data_.load(memory_order_seq_cst);
+            assert(ptr_ != nullptr && "Singleton accessed before initialization.");
+        }
+    };
+
+    static
+    read_guard
+    read()
+    {
+        return read_guard(&local().get());
+    }
+
+    static
+    bool
+    initialized()
+    noexcept
+    {
+        return data_.load(memory_order_acquire) != nullptr;
+    }
+
+    // Construct the first version, if none has been published.
+    template <typename ... Ts>
+    static
+    void
+    init(
+        Ts&&... ts
+    )
+    {
+        lock_guard<mutex> lock(writer().mu);
+        if (data_.load(memory_order_relaxed) == nullptr) {
+            data_.store(new value_type(forward<Ts>(ts)...), memory_order_release);
+        }
+    }
+
+    template <typename ... Ts>
+    static
+    void
+    publish(
+        Ts&&... ts
+    )
+    {
+        unique_ptr<value_type> p(new value_type(forward<Ts>(ts)...));
+        lock_guard<mutex> lock(writer().mu);
+        replace(p.release());
+    }
+
+    // Copy the current version, modify it with `f`, and publish the copy.
+    template <typename Function>
+    static
+    void
+    update(
+        Function f
+    )
+    {
+        lock_guard<mutex> lock(writer().mu);
+        const value_type* current = data_.load(memory_order_relaxed);
+        assert(current != nullptr && "Singleton accessed before initialization.");
+        unique_ptr<value_type> p(new value_type(*current));
+        f(*p);
+        replace(p.release());
+    }
+
+    // Wait for the grace period of every retired version.
+    static
+    void
+    synchronize()
+    {
+        while (true) {
+            {
+                lock_guard<mutex> lock(writer().mu);
+                reclaim();
+                if (writer().retired.empty()) {
+                    return;
+                }
+            }
+            this_thread::yield();
+        }
+    }
+
+    // Retire the current version, and wait for its reclamation.
+    static
+    void
+    destroy()
+    {
+        {
+            lock_guard<mutex> lock(writer().mu);
+            replace(nullptr);
+        }
+        synchronize();
+    }
+
+private:
+    struct retired_version
+    {
+        value_type* ptr;
+        uint64_t epoch;
+    };
+
+    struct writer_state
+    {
+        mutex mu;
+        vector<retired_version> retired;
+    };
+
+    // Claims a record the first time a thread reads, and releases
+    // it on thread exit.
+    struct local_record
+    {
+        record* r = nullptr;
+
+        ~local_record()
+        {
+            if (r != nullptr) {
+                assert(r->depth == 0 && "Read guard outlived its thread.");
+                r->in_use.store(false, memory_order_release);
+            }
+        }
+
+        record&
+        get()
+        {
+            if (r == nullptr) {
+                r = acquire();
+            }
+            return *r;
+        }
+    };
+
+    static atomic<value_type*> data_;
+    static atomic<uint64_t> epoch_;
+    static atomic<record*> records_;
+
+    static
+    local_record&
+    local()
+    noexcept
+    {
+        static thread_local local_record r;
+        return r;
+    }
+
+    static
+    writer_state&
+    writer()
+    {
+        static writer_state w;
+        return w;
+    }
+
+    static
+    record*
+    acquire()
+    {
+        for (record* r = records_.load(memory_order_acquire); r != nullptr; r = r->next) {
+            bool expected = false;
+            if (r->in_use.compare_exchange_strong(expected, true, memory_order_acquire)) {
+                return r;
+            }
+        }
+
+        // records are never removed, so pushing is ABA-safe
+        record* r = new record;
+        r->next = records_.load(memory_order_relaxed);
+        while (!records_.compare_exchange_weak(r->next, r, memory_order_release, memory_order_relaxed))
+        {}
+        return r;
+    }
+
+    // Must hold the writer lock.
+    static
+    void
+    replace(
+        value_type* p
+    )
+    {
+        value_type* old = data_.exchange(p, memory_order_seq_cst);
+        uint64_t epoch = epoch_.fetch_add(1, memory_order_seq_cst);
+        if (old != nullptr) {
+            writer().retired.push_back(retired_version {old, epoch});
+        }
+        reclaim();
+    }
+
+    // Free every version retired before the oldest active reader
+    // started. Must hold the writer lock.
+    static
+    void
+    reclaim()
+    {
+        vector<retired_version>& retired = writer().retired;
+        if (retired.empty()) {
+            return;
+        }
+
+        uint64_t oldest = UINT64_MAX;
+        for (record* r = records_.load(memory_order_acquire); r != nullptr; r = r->next) {
+            uint64_t e = r->epoch.load(memory_order_seq_cst);
+            if (e != 0 && e < oldest) {
+                oldest = e;
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); ++i) {
+            if (retired[i].epoch < oldest) {
+                delete retired[i].ptr;
+            } else {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize(kept);
+    }
+};
+
+template <typename T>
+atomic<T*>
+rcu_singleton<T>::data_ = ATOMIC_VAR_INIT(nullptr);
+
+// epochs start at 1, since 0 marks a quiescent reader
+template <typename T>
+atomic<uint64_t>
+rcu_singleton<T>::epoch_ = ATOMIC_VAR_INIT(1);
+
+template <typename T>
+atomic<rcu_detail::rcu_record*>
+rcu_singleton<T>::records_ = ATOMIC_VAR_INIT(nullptr);
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,158 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Relocation of objects to uninitialized memory.
+ *
+ *  Relocation moves an object to a new address and destroys the
+ *  original, leaving the source as uninitialized memory. For types
+ *  where `is_relocatable` holds, including the PIMPL wrappers, this
+ *  lowers to a single `memcpy` or `memmove`, rather than a move
+ *  constructor and destructor call per object. This allows containers
+ *  of PIMPL objects to grow and erase elements with bulk copies.
+ *
+ *  `uninitialized_relocate_n` supports overlapping ranges when the
+ *  destination precedes the source, for example, when shifting the
+ *  tail of an array after removing an element. If a move constructor
+ *  throws, the objects relocated so far are destroyed, and the rest
+ *  remain in the source range.
+ *
+ *  \synopsis
+ *      template <typename T>
+ *      T* relocate_at(T* src, T* dst);
+ *
+ *      template <typename T>
+ *      T* uninitialized_relocate_n(T* first, size_t n, T* dst);
+ */
+
+#pragma once
+
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstring.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace relocate_detail
+{
+// DETAIL
+// ------
+
+template <typename T>
+inline
+void
+relocate_at(
+    T* src,
+    T* dst,
+    true_type
+)
+noexcept
+{
+    memcpy(static_cast<void*>(dst), static_cast<const void*>(src), sizeof(T));
+}
+
+
+template <typename T>
+inline
+void
+relocate_at(
+    T* src,
+    T* dst,
+    false_type
+)
+{
+    ::new (static_cast<void*>(dst)) T(move(*src));
+    src->~T();
+}
+
+
+template <typename T>
+inline
+void
+uninitialized_relocate_n(
+    T* first,
+    size_t n,
+    T* dst,
+    true_type
+)
+noexcept
+{
+    if (n != 0) {
+        memmove(static_cast<void*>(dst), static_cast<const void*>(first), n * sizeof(T));
+    }
+}
+
+
+template <typename T>
+inline
+void
+uninitialized_relocate_n(
+    T* first,
+    size_t n,
+    T* dst,
+    false_type
+)
+{
+    T* start = dst;
+    try {
+        for (; n != 0; --n, ++first, ++dst) {
+            relocate_at(first, dst, false_type());
+        }
+    } catch (...) {
+        // the sources of the relocated objects are already destroyed,
+        // so destroy the relocated objects rather than leak them
+        for (; start != dst; ++start) {
+            start->~T();
+        }
+        throw;
+    }
+}
+
+}   /* relocate_detail */
+
+// FUNCTIONS
+// ---------
+
+/**
+ *  \brief Relocate a single object from `src` to uninitialized `dst`.
+ */
+template <typename T>
+inline
+T*
+relocate_at(
+    T* src,
+    T* dst
+)
+noexcept(is_relocatable<T>::value || is_nothrow_move_constructible<T>::value)
+{
+    relocate_detail::relocate_at(src, dst, is_relocatable<T>());
+    return dst;
+}
+
+
+/**
+ *  \brief Relocate `n` objects from `first` to uninitialized `dst`.
+ *
+ *  If a move constructor throws, the objects relocated so far are
+ *  destroyed, leaving `dst` uninitialized, and the object which threw
+ *  and every later object remain constructed in the source range.
+ *
+ *  \return     Pointer past the last relocated object in `dst`.
+ */
+template <typename T>
+inline
+T*
+uninitialized_relocate_n(
+    T* first,
+    size_t n,
+    T* dst
+)
+noexcept(is_relocatable<T>::value || is_nothrow_move_constructible<T>::value)
+{
+    relocate_detail::uninitialized_relocate_n(first, n, dst, is_relocatable<T>());
+    return dst + n;
+}
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,654 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief PIMPL idiom with a small-buffer optimization.
+ *
+ *  Hybrid of `stack_pimpl` and `unique_heap_pimpl`, which stores
+ *  the implied member in an inline buffer of a fixed capacity if
+ *  the type fits, and otherwise stores a pointer to an allocated
+ *  member in the same buffer. Unlike `stack_pimpl`, the capacity
+ *  does not need to match the size of the type exactly, so the
+ *  implied type may grow without changing the layout of the public
+ *  class, at the cost of an allocation once it no longer fits.
+ *
+ *  Whether the member is stored inline is decided from the complete
+ *  type, so the choice is made in the translation unit defining the
+ *  implied class. The buffer must be large enough to hold the heap
+ *  fallback, which is checked at compile-time in the destructor.
+ *
+ *  With heap storage, moves transfer ownership of the pointer, and
+ *  the moved-from wrapper may only be assigned to, swapped or
+ *  destroyed, just like `unique_heap_pimpl`. With inline storage,
+ *  moves move the implied member.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/sbo_pimpl.h>
+ *
+ *      struct file_impl;
+ *      struct file
+ *      {
+ *      public:
+ *      private:
+ *          sbo_pimpl<file_impl, 64> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      template <
+ *          typename T,
+ *          size_t Capacity,
+ *          size_t Alignment = alignof(max_align_t),
+ *          typename Allocator = allocator<T>
+ *      >
+ *      class sbo_pimpl
+ *      {
+ *      public:
+ *          static constexpr size_t capacity = Capacity;
+ *          static constexpr size_t alignment = Alignment;
+ *
+ *          using value_type = T;
+ *          using reference = T&;
+ *          using const_reference = const T&;
+ *          using pointer = T*;
+ *          using const_pointer = const T*;
+ *          using allocator_type = Allocator;
+ *          using traits_type = allocator_traits<allocator_type>;
+ *          using deleter_type = implementation-defined;
+ *          using storage_type = unique_ptr<value_type, deleter_type>;
+ *
+ *          static constexpr bool stored_inline() noexcept;
+ *
+ *          sbo_pimpl();
+ *          sbo_pimpl(const allocator_type& alloc);
+ *          sbo_pimpl(const sbo_pimpl& x);
+ *          sbo_pimpl(const sbo_pimpl& x, const allocator_type& alloc);
+ *          sbo_pimpl(const value_type& x);
+ *          sbo_pimpl(const value_type& x, const allocator_type& alloc);
+ *          sbo_pimpl(sbo_pimpl&& x) noexcept(see below);
+ *          sbo_pimpl(value_type&& x);
+ *          sbo_pimpl(value_type&& x, const allocator_type& alloc);
+ *          sbo_pimpl& operator=(const sbo_pimpl& x);
+ *          sbo_pimpl& operator=(const value_type& x);
+ *          sbo_pimpl& operator=(sbo_pimpl&& x) noexcept(see below);
+ *          sbo_pimpl& operator=(value_type&& x);
+ *          ~sbo_pimpl();
+ *
+ *          reference operator*() noexcept;
+ *          const_reference operator*() const noexcept;
+ *          pointer operator->() noexcept;
+ *          const_pointer operator->() const noexcept;
+ *          operator reference() noexcept;
+ *          operator const_reference() const noexcept;
+ *          reference get() noexcept;
+ *          const_reference get() const noexcept;
+ *          allocator_type get_allocator() const noexcept;
+ *
+ *          void swap(sbo_pimpl& x);
+ *      };
+ *
+ *      template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+ *      void swap(sbo_pimpl<T, Capacity, Alignment, Allocator>& x, sbo_pimpl<T, Capacity, Alignment, Allocator>& y);
+ *
+ *      template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+ *      struct is_relocatable<sbo_pimpl<T, Capacity, Alignment, Allocator>>;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/heap_pimpl.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/memory.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace sbo_detail
+{
+// DETAIL
+// ------
+
+// Only evaluated inside member functions, where `T` is complete.
+
+template <typename T, size_t Capacity, size_t Alignment>
+struct is_inline: integral_constant<bool,
+    sizeof(T) <= Capacity && alignof(T) <= Alignment
+>
+{};
+
+
+template <typename T, size_t Capacity, size_t Alignment>
+struct is_nothrow_movable: integral_constant<bool,
+    !is_inline<T, Capacity, Alignment>::value ||
+    is_nothrow_move_constructible<T>::value
+>
+{};
+
+
+// The heap fallback only steals the pointer without allocating if
+// the allocator propagates or always compares equal.
+template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+struct is_nothrow_move_assign: integral_constant<bool,
+    is_inline<T, Capacity, Alignment>::value ?
+        is_nothrow_move_assignable<T>::value :
+        (allocator_traits<Allocator>::propagate_on_container_move_assignment::value ||
+         allocator_traits<Allocator>::is_always_equal::value)
+>
+{};
+
+}   /* sbo_detail */
+
+// DECLARATION
+// -----------
+
+/**
+ *  \brief PIMPL idiom storing small types inline and large types on the heap.
+ */
+template <
+    typename T,
+    size_t Capacity,
+    size_t Alignment = alignof(max_align_t),
+    typename Allocator = allocator<T>
+>
+class sbo_pimpl
+{
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t capacity = Capacity;
+    static constexpr size_t alignment = Alignment;
+
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using allocator_type = Allocator;
+    using traits_type = allocator_traits<allocator_type>;
+    using deleter_type = heap_detail::heap_pimpl_deleter<T, Allocator>;
+    using storage_type = unique_ptr<value_type, deleter_type>;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    static
+    constexpr
+    bool
+    stored_inline()
+    noexcept
+    {
+        return sbo_detail::is_inline<T, Capacity, Alignment>::value;
+    }
+
+    // Constructors
+    sbo_pimpl()
+    {
+        construct(allocator_type());
+    }
+
+    sbo_pimpl(
+        const allocator_type& alloc
+    )
+    {
+        construct(alloc);
+    }
+
+    // Copy constructors
+    sbo_pimpl(
+        const sbo_pimpl& x
+    )
+    {
+        construct(allocator_type(), x.get());
+    }
+
+    sbo_pimpl(
+        const sbo_pimpl& x,
+        const allocator_type& alloc
+    )
+    {
+        construct(alloc, x.get());
+    }
+
+    sbo_pimpl(
+        const value_type& x
+    )
+    {
+        construct(allocator_type(), x);
+    }
+
+    sbo_pimpl(
+        const value_type& x,
+        const allocator_type& alloc
+    )
+    {
+        construct(alloc, x);
+    }
+
+    // Move constructors
+    sbo_pimpl(
+        sbo_pimpl&& x
+    )
+    noexcept(sbo_detail::is_nothrow_movable<T, Capacity, Alignment>::value)
+    {
+        move_construct(x, inline_type());
+    }
+
+    sbo_pimpl(
+        value_type&& x
+    )
+    {
+        construct(allocator_type(), move(x));
+    }
+
+    sbo_pimpl(
+        value_type&& x,
+        const allocator_type& alloc
+    )
+    {
+        construct(alloc, move(x));
+    }
+
+    // Assignment
+    sbo_pimpl&
+    operator=(
+        const sbo_pimpl& x
+    )
+    {
+        if (this != &x) {
+            assign(x.get(), inline_type());
+        }
+        return *this;
+    }
+
+    sbo_pimpl&
+    operator=(
+        const value_type& x
+    )
+    {
+        assign(x, inline_type());
+        return *this;
+    }
+
+    sbo_pimpl&
+    operator=(
+        sbo_pimpl&& x
+    )
+    noexcept(sbo_detail::is_nothrow_move_assign<T, Capacity, Alignment, Allocator>::value)
+    {
+        if (this != &x) {
+            move_assign(x, inline_type());
+        }
+        return *this;
+    }
+
+    sbo_pimpl&
+    operator=(
+        value_type&& x
+    )
+    {
+        assign(move(x), inline_type());
+        return *this;
+    }
+
+    ~sbo_pimpl()
+    {
+        static_assert(sizeof(storage_type) <= Capacity, "Capacity cannot hold the heap fallback.");
+        static_assert(alignof(storage_type) <= Alignment, "Alignment cannot hold the heap fallback.");
+        destroy(inline_type());
+    }
+
+    // Observers
+    reference
+    operator*()
+    noexcept
+    {
+        return get();
+    }
+
+    const_reference
+    operator*()
+    const noexcept
+    {
+        return get();
+    }
+
+    pointer
+    operator->()
+    noexcept
+    {
+        return &get();
+    }
+
+    const_pointer
+    operator->()
+    const noexcept
+    {
+        return &get();
+    }
+
+    operator
+    reference()
+    noexcept
+    {
+        return get();
+    }
+
+    operator
+    const_reference()
+    const noexcept
+    {
+        return get();
+    }
+
+    reference
+    get()
+    noexcept
+    {
+        return get(inline_type());
+    }
+
+    const_reference
+    get()
+    const noexcept
+    {
+        return get(inline_type());
+    }
+
+    allocator_type
+    get_allocator()
+    const noexcept
+    {
+        return get_allocator(inline_type());
+    }
+
+    // Modifiers
+    void
+    swap(
+        sbo_pimpl& x
+    )
+    {
+        swap_impl(x, inline_type());
+    }
+
+private:
+    using memory_type = aligned_storage_t<Capacity, Alignment>;
+    memory_type mem_;
+
+    // Only instantiated in member function bodies, once `T` is complete.
+    using inline_type = sbo_detail::is_inline<T, Capacity, Alignment>;
+    using move_assign_steals = integral_constant<bool,
+        traits_type::propagate_on_container_move_assignment::value ||
+        traits_type::is_always_equal::value
+    >;
+
+    storage_type&
+    ptr()
+    noexcept
+    {
+        return reinterpret_cast<storage_type&>(mem_);
+    }
+
+    const storage_type&
+    ptr()
+    const noexcept
+    {
+        return reinterpret_cast<const storage_type&>(mem_);
+    }
+
+    // Construction
+    template <typename ... Ts>
+    void
+    construct(
+        const allocator_type& alloc,
+        Ts&&... ts
+    )
+    {
+        construct_impl(inline_type(), alloc, forward<Ts>(ts)...);
+    }
+
+    template <typename ... Ts>
+    void
+    construct_impl(
+        true_type,
+        const allocator_type&,
+        Ts&&... ts
+    )
+    {
+        new (&mem_) value_type(forward<Ts>(ts)...);
+    }
+
+    template <typename ... Ts>
+    void
+    construct_impl(
+        false_type,
+        const allocator_type& alloc,
+        Ts&&... ts
+    )
+    {
+        new (&mem_) storage_type(allocate_heap_pimpl<value_type>(alloc, forward<Ts>(ts)...));
+    }
+
+    void
+    move_construct(
+        sbo_pimpl& x,
+        true_type
+    )
+    {
+        new (&mem_) value_type(move(x.get()));
+    }
+
+    void
+    move_construct(
+        sbo_pimpl& x,
+        false_type
+    )
+    noexcept
+    {
+        new (&mem_) storage_type(move(x.ptr()));
+    }
+
+    void
+    destroy(
+        true_type
+    )
+    {
+        get().~T();
+    }
+
+    void
+    destroy(
+        false_type
+    )
+    {
+        ptr().~storage_type();
+    }
+
+    // Observers
+    reference
+    get(
+        true_type
+    )
+    noexcept
+    {
+        return reinterpret_cast<reference>(mem_);
+    }
+
+    reference
+    get(
+        false_type
+    )
+    noexcept
+    {
+        return *ptr();
+    }
+
+    const_reference
+    get(
+        true_type
+    )
+    const noexcept
+    {
+        return reinterpret_cast<const_reference>(mem_);
+    }
+
+    const_reference
+    get(
+        false_type
+    )
+    const noexcept
+    {
+        return *ptr();
+    }
+
+    allocator_type
+    get_allocator(
+        true_type
+    )
+    const noexcept
+    {
+        return allocator_type();
+    }
+
+    allocator_type
+    get_allocator(
+        false_type
+    )
+    const noexcept
+    {
+        return ptr().get_deleter().get_allocator();
+    }
+
+    // Assignment
+    template <typename U>
+    void
+    assign(
+        U&& x,
+        true_type
+    )
+    {
+        get() = forward<U>(x);
+    }
+
+    // A moved-from wrapper holds no value, so re-create the
+    // implied member from our own allocator.
+    template <typename U>
+    void
+    assign(
+        U&& x,
+        false_type
+    )
+    {
+        if (ptr()) {
+            get() = forward<U>(x);
+        } else {
+            ptr() = allocate_heap_pimpl<value_type>(get_allocator(), forward<U>(x));
+        }
+    }
+
+    void
+    move_assign(
+        sbo_pimpl& x,
+        true_type
+    )
+    {
+        get() = move(x.get());
+    }
+
+    void
+    move_assign(
+        sbo_pimpl& x,
+        false_type
+    )
+    {
+        move_assign_heap(x, move_assign_steals());
+    }
+
+    void
+    move_assign_heap(
+        sbo_pimpl& x,
+        true_type
+    )
+    noexcept
+    {
+        ptr() = move(x.ptr());
+    }
+
+    void
+    move_assign_heap(
+        sbo_pimpl& x,
+        false_type
+    )
+    {
+        // cannot take ownership of memory from an unequal allocator
+        if (get_allocator() == x.get_allocator()) {
+            value_type* p = x.ptr().release();
+            ptr().reset(p);
+        } else if (!x.ptr()) {
+            ptr().reset();
+        } else {
+            assign(move(x.get()), false_type());
+        }
+    }
+
+    // Modifiers
+    void
+    swap_impl(
+        sbo_pimpl& x,
+        true_type
+    )
+    {
+        fast_swap(get(), x.get());
+    }
+
+    void
+    swap_impl(
+        sbo_pimpl& x,
+        false_type
+    )
+    {
+        if (traits_type::propagate_on_container_swap::value || traits_type::is_always_equal::value) {
+            fast_swap(ptr(), x.ptr());
+        } else {
+            // can only swap the allocators if they're equal
+            assert(get_allocator() == x.get_allocator() && "Cannot swap if allocators are not equal.");
+            value_type* lp = ptr().release();
+            value_type* rp = x.ptr().release();
+            ptr().reset(rp);
+            x.ptr().reset(lp);
+        }
+    }
+};
+
+template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+void
+swap(
+    sbo_pimpl<T, Capacity, Alignment, Allocator>& x,
+    sbo_pimpl<T, Capacity, Alignment, Allocator>& y
+)
+{
+    return x.swap(y);
+}
+
+// SPECIALIZATION
+// --------------
+
+template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+struct is_relocatable<sbo_pimpl<T, Capacity, Alignment, Allocator>>: conditional_t<
+        sbo_detail::is_inline<T, Capacity, Alignment>::value,
+        is_relocatable<T>,
+        is_relocatable<unique_heap_pimpl<T, Allocator>>
+    >
+{};
+
+// IMPLEMENTATION
+// --------------
+
+template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+const size_t sbo_pimpl<T, Capacity, Alignment, Allocator>::capacity;
+
+template <typename T, size_t Capacity, size_t Alignment, typename Allocator>
+const size_t sbo_pimpl<T, Capacity, Alignment, Allocator>::alignment;
+
+PYCPP_END_NAMESPACE
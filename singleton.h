@@ -13,10 +13,70 @@
  *  both the type-size and type-alignment **must** be provided.
  *  This assertion is checked at compile-time in the destructor.
  *
+ *  The `heap_singleton` allocates the instance with `new` by default,
+ *  or from a default-constructed `Allocator`, for example, to back
+ *  large tables with huge pages using `huge_page_allocator`, or to
+ *  place the instance on the NUMA node of the constructing thread
+ *  with `numa_allocator`. The allocator only provides the
+ *  `sizeof(T)` bytes of the instance itself, so memory the instance
+ *  allocates, such as the buffers of its containers, comes from their
+ *  own allocators, and only tables stored inline in `T` benefit. No
+ *  allocator is stored, and a new one is default-constructed for each
+ *  allocation and deallocation, so the allocator must be stateless,
+ *  with `is_always_equal`. For example, `numa_allocator` cannot target
+ *  a specific node.
+ *
  *  To avoid superfluous overhead for single-threaded conditions,
  *  each singleton comes in multi- and single-threaded variants.
  *  The multi-threaded variant uses atomics to ensure a mutex is
  *  only locked during initialization, with notable performance gains.
+ *  The multi-threaded `stack_singleton` avoids the mutex entirely,
+ *  using an atomic state machine where the first caller constructs
+ *  the instance and concurrent callers wait for it to be published,
+ *  so every access after initialization is a single acquire load.
+ *
+ *  Construction and access are split, so the steady-state access
+ *  never touches the constructor arguments. `get` constructs the
+ *  instance on first use, forwarding the arguments, while `init`
+ *  explicitly constructs the instance, and `instance` accesses an
+ *  instance which must already be initialized. Arguments passed after
+ *  the singleton is constructed are ignored.
+ *
+ *  The `constant_singleton` is constant-initialized in static storage
+ *  at compile time, for types with a `constexpr` default constructor
+ *  and a trivial destructor, so every access is a plain address with
+ *  no branch or atomic load, for example, for lookup tables read in
+ *  inner loops. With C++20, the constant initialization is enforced
+ *  with `constinit`, and with Clang, with the
+ *  `require_constant_initialization` attribute. Otherwise, the
+ *  guarantee does not hold: a non-`constexpr` constructor silently
+ *  falls back to dynamic initialization before `main`, and other
+ *  static initializers may access the instance before it is
+ *  constructed.
+ *
+ *  The `thread_local_singleton` creates one instance per thread,
+ *  constructed lazily on the first access from that thread and
+ *  destroyed when the thread exits. Access never synchronizes, while
+ *  a mutex guards the list of live instances, which is only locked
+ *  when a thread constructs or destroys its instance, or when
+ *  iterating over every instance with `for_each`.
+ *
+ *  The `sharded_singleton` stores a fixed number of instances, each
+ *  aligned to a separate cache line, and maps each access to a shard
+ *  by thread or by CPU. The instances are still shared, so they must
+ *  be safe to use concurrently, but spreading the updates over shards
+ *  avoids cache lines bouncing between cores, for example, for
+ *  statistics counters which are aggregated with `reduce`.
+ *
+ *  The heap and stack singletons record their accesses, construction
+ *  time and initialization stalls when `USE_SINGLETON_INSTRUMENTATION`
+ *  is defined, see `singleton_instrumentation.h`.
+ *
+ *  The heap and stack singletons are never destroyed implicitly. `destroy`
+ *  destroys the instance, after which the next access constructs a new
+ *  one, and must not run concurrently with any other access. The
+ *  `singleton_registry` uses it to tear singletons down in dependency
+ *  order.
  *
  *  In debug builds, the singleton pattern asserts in the destructor if
  *  it is used outside of a singleton policy. For example:
@@ -32,15 +92,20 @@
  *      }
  *
  *  \synopsis
- *      template <typename T, bool ThreadSafe>
+ *      template <typename T, bool ThreadSafe = true, typename Allocator = allocator<T>>
  *      class heap_singleton
  *      {
  *      public:
  *          static constexpr bool thread_safe = ThreadSafe;
  *          using value_type = T;
+ *          using allocator_type = Allocator;
  *
  *          template<typename ... Ts>
- *          static value_type& get(Ts... ts);
+ *          static value_type& get(Ts&&... ts);
+ *          template<typename ... Ts>
+ *          static value_type& init(Ts&&... ts);
+ *          static value_type& instance() noexcept;
+ *          static void destroy() noexcept;
  *
  *      protected:
  *          heap_singleton() = default;
@@ -49,7 +114,13 @@
  *          ~heap_singleton();
  *      };
  *
- *      template <typename T, size_t Size, size_t Alignment, bool ThreadSafe>
+ *      template <
+ *          typename T,
+ *          size_t Size,
+ *          size_t Alignment,
+ *          bool ThreadSafe,
+ *          storage_policy Policy = storage_exact
+ *      >
  *      class stack_singleton
  *      {
  *      public:
@@ -58,7 +129,11 @@
  *          using storage_type = aligned_storage_t<Size, Alignment>;
  *
  *          template<typename... Ts>
- *          static value_type& get(Ts... ts);
+ *          static value_type& get(Ts&&... ts);
+ *          template<typename... Ts>
+ *          static value_type& init(Ts&&... ts);
+ *          static value_type& instance() noexcept;
+ *          static void destroy() noexcept;
  *
  *      protected:
  *          stack_singleton() = default;
@@ -66,19 +141,237 @@
  *          stack_singleton& operator=(const stack_singleton&) = delete;
  *          ~stack_singleton();
  *      };
+ *
+ *      template <typename T, size_t Size, size_t Alignment = cache_line_size, bool ThreadSafe = true>
+ *      using padded_stack_singleton = stack_singleton<T, Size, Alignment, ThreadSafe, storage_padded>;
+ *
+ *      template <typename T>
+ *      class constant_singleton
+ *      {
+ *      public:
+ *          using value_type = T;
+ *
+ *          static constexpr value_type& get() noexcept;
+ *          static constexpr value_type& instance() noexcept;
+ *          static void destroy() noexcept;
+ *
+ *      protected:
+ *          constexpr constant_singleton() noexcept = default;
+ *          constant_singleton(const constant_singleton&) = delete;
+ *          constant_singleton& operator=(const constant_singleton&) = delete;
+ *      };
+ *
+ *      template <typename T>
+ *      class thread_local_singleton
+ *      {
+ *      public:
+ *          using value_type = T;
+ *
+ *          template<typename... Ts>
+ *          static value_type& get(Ts&&... ts);
+ *          template<typename... Ts>
+ *          static value_type& init(Ts&&... ts);
+ *          static value_type& instance() noexcept;
+ *
+ *          template <typename Function>
+ *          static void for_each(Function f);
+ *
+ *      protected:
+ *          thread_local_singleton() = default;
+ *          thread_local_singleton(const thread_local_singleton&) = delete;
+ *          thread_local_singleton& operator=(const thread_local_singleton&) = delete;
+ *          ~thread_local_singleton();
+ *      };
+ *
+ *      enum shard_policy
+ *      {
+ *          shard_by_thread,
+ *          shard_by_cpu,
+ *      };
+ *
+ *      template <
+ *          typename T,
+ *          size_t Size,
+ *          size_t Shards,
+ *          size_t Alignment = cache_line_size,
+ *          shard_policy Policy = shard_by_thread
+ *      >
+ *      class sharded_singleton
+ *      {
+ *      public:
+ *          static constexpr size_t shards = Shards;
+ *          using value_type = T;
+ *          using storage_type = aligned_storage_t<Size, Alignment>;
+ *
+ *          template<typename... Ts>
+ *          static value_type& get(Ts&&... ts);
+ *          template<typename... Ts>
+ *          static value_type& init(Ts&&... ts);
+ *          static value_type& shard(size_t index) noexcept;
+ *          static size_t shard_index() noexcept;
+ *
+ *          template <typename Function>
+ *          static void for_each_shard(Function f);
+ *          template <typename U, typename BinaryFunction>
+ *          static U reduce(U init, BinaryFunction f);
+ *
+ *      protected:
+ *          sharded_singleton() = default;
+ *          sharded_singleton(const sharded_singleton&) = delete;
+ *          sharded_singleton& operator=(const sharded_singleton&) = delete;
+ *          ~sharded_singleton();
+ *      };
  */
 
 #pragma once
 
 #include <pycpp/config.h>
+#include <pycpp/adaptor/singleton_instrumentation.h>
 #include <pycpp/adaptor/stack_pimpl.h>
 #include <pycpp/stl/atomic.h>
 #include <pycpp/stl/cassert.h>
 #include <pycpp/stl/memory.h>
 #include <pycpp/stl/mutex.h>
+#include <pycpp/stl/stdexcept.h>
+#include <pycpp/stl/thread.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#endif
 
 PYCPP_BEGIN_NAMESPACE
 
+namespace singleton_detail
+{
+// DETAIL
+// ------
+
+enum singleton_state: int
+{
+    singleton_uninitialized = 0,
+    singleton_initializing,
+    singleton_initialized,
+};
+
+/**
+ *  \brief Wait until another thread leaves the initializing state.
+ *
+ *  Spins briefly, since construction is typically short, before
+ *  blocking on the atomic (when supported) or yielding the thread.
+ */
+inline
+int
+wait_initializing(
+    atomic<int>& state
+)
+noexcept
+{
+    int s = state.load(memory_order_acquire);
+    for (int i = 0; s == singleton_initializing && i < 64; ++i) {
+        s = state.load(memory_order_acquire);
+    }
+    while (s == singleton_initializing) {
+#if defined(__cpp_lib_atomic_wait)
+        state.wait(s, memory_order_acquire);
+#else
+        this_thread::yield();
+#endif
+        s = state.load(memory_order_acquire);
+    }
+    return s;
+}
+
+/**
+ *  \brief Publish a new state and wake any waiting threads.
+ */
+inline
+void
+publish_state(
+    atomic<int>& state,
+    int s
+)
+noexcept
+{
+    state.store(s, memory_order_release);
+#if defined(__cpp_lib_atomic_wait)
+    state.notify_all();
+#endif
+}
+
+// Construct the heap instance, with `new` for the default allocator,
+// to respect any class-specific `operator new`.
+template <typename T, typename Allocator, typename ... Ts>
+inline
+T*
+heap_construct(
+    true_type,
+    Ts&&... ts
+)
+{
+    return new T(forward<Ts>(ts)...);
+}
+
+
+template <typename T, typename Allocator, typename ... Ts>
+inline
+T*
+heap_construct(
+    false_type,
+    Ts&&... ts
+)
+{
+    using allocator_type = typename allocator_traits<Allocator>::template rebind_alloc<T>;
+    using traits = allocator_traits<allocator_type>;
+    static_assert(traits::is_always_equal::value, "Singleton allocator must be stateless.");
+
+    allocator_type alloc;
+    T* p = traits::allocate(alloc, 1);
+    try {
+        ::new (static_cast<void*>(p)) T(forward<Ts>(ts)...);
+    } catch (...) {
+        traits::deallocate(alloc, p, 1);
+        throw;
+    }
+    return p;
+}
+
+
+template <typename T, typename Allocator>
+inline
+void
+heap_destroy(
+    T* p,
+    true_type
+)
+noexcept
+{
+    delete p;
+}
+
+
+template <typename T, typename Allocator>
+inline
+void
+heap_destroy(
+    T* p,
+    false_type
+)
+noexcept
+{
+    using allocator_type = typename allocator_traits<Allocator>::template rebind_alloc<T>;
+    using traits = allocator_traits<allocator_type>;
+
+    allocator_type alloc;
+    p->~T();
+    traits::deallocate(alloc, p, 1);
+}
+
+
+template <typename T, typename Allocator>
+using is_default_allocator = is_same<Allocator, allocator<T>>;
+
+}   /* singleton_detail */
+
 // OBJECTS
 // -------
 
@@ -88,30 +381,82 @@ PYCPP_BEGIN_NAMESPACE
  *  Use `dummy_mutex` to disable thread-safety. Since the object is
  *  only allocated a single time, the global allocator is sufficient.
  */
-template <typename T, bool ThreadSafe = true>
+template <typename T, bool ThreadSafe = true, typename Allocator = allocator<T>>
 class heap_singleton;
 
 // Single-threaded
-template <typename T>
-class heap_singleton<T, false>
+template <typename T, typename Allocator>
+class heap_singleton<T, false, Allocator>
 {
 public:
     static constexpr bool thread_safe = false;
     using value_type = T;
+    using allocator_type = Allocator;
 
     template<typename ... Ts>
     static
     value_type&
     get(
-        Ts... ts
+        Ts&&... ts
     )
     {
+        singleton_record_access<heap_singleton>();
         if (data_ == nullptr) {
-            data_ = new value_type(forward<Ts>(ts)...);
+            return init(forward<Ts>(ts)...);
         }
         return *data_;
     }
 
+    template<typename ... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+        if (data_ == nullptr) {
+            // restore rather than clear the flag, since a destructor
+            // run by `destroy` may re-create the instance
+            bool managed = managed_;
+            managed_ = true;
+            singleton_timer timer;
+            try {
+                data_ = construct(forward<Ts>(ts)...);
+            } catch (...) {
+                managed_ = managed;
+                throw;
+            }
+            singleton_record_construction<heap_singleton>(timer.elapsed());
+            managed_ = managed;
+        }
+        return *data_;
+    }
+
+    static
+    value_type&
+    instance()
+    noexcept
+    {
+        assert(data_ != nullptr && "Singleton accessed before initialization.");
+        return *data_;
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        // use temporary to avoid recursion
+        value_type* tmp = data_;
+        data_ = nullptr;
+        if (tmp != nullptr) {
+            bool managed = managed_;
+            managed_ = true;
+            singleton_detail::heap_destroy<T, Allocator>(tmp, is_default());
+            managed_ = managed;
+        }
+    }
+
 protected:
     heap_singleton() = default;
     heap_singleton(const heap_singleton&) = delete;
@@ -119,51 +464,129 @@ protected:
 
     ~heap_singleton()
     {
-        // use temporary to avoid recursion
-        value_type* tmp = data_;
-        data_ = nullptr;
-        delete tmp;
 #ifndef NDEBUG
-        assert(tmp != nullptr && "Singleton used outside of pattern.");
+        assert(managed_ && "Singleton used outside of pattern.");
 #endif
     }
 
 private:
     static value_type* data_;
+    // whether the pattern is constructing or destroying the instance
+    static bool managed_;
+
+    using is_default = singleton_detail::is_default_allocator<T, Allocator>;
+
+    template<typename ... Ts>
+    static
+    value_type*
+    construct(
+        Ts&&... ts
+    )
+    {
+        return singleton_detail::heap_construct<T, Allocator>(is_default(), forward<Ts>(ts)...);
+    }
 };
 
-template <typename T>
+template <typename T, typename Allocator>
 T*
-heap_singleton<T, false>::data_ = nullptr;
+heap_singleton<T, false, Allocator>::data_ = nullptr;
+
+template <typename T, typename Allocator>
+bool
+heap_singleton<T, false, Allocator>::managed_ = false;
 
 
 // Multi-threaded
-template <typename T>
-class heap_singleton<T, true>
+template <typename T, typename Allocator>
+class heap_singleton<T, true, Allocator>
 {
 public:
     static constexpr bool thread_safe = true;
     using value_type = T;
+    using allocator_type = Allocator;
 
     template<typename ... Ts>
     static
     value_type&
     get(
-        Ts... ts
+        Ts&&... ts
     )
     {
+        singleton_record_access<heap_singleton>();
         T* p = data_.load(memory_order_acquire);
         if (p == nullptr) {
-            lock_guard<mutex> lock(mu_);
-            p = data_.load(memory_order_relaxed);
-            if (p == nullptr) {
-                p = new T(forward<Ts>(ts)...);
-                data_.store(p, memory_order_release);
+            return init(forward<Ts>(ts)...);
+        }
+        return *p;
+    }
+
+    template<typename ... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+        unique_lock<mutex> lock(mu_, try_to_lock);
+        if (!lock.owns_lock()) {
+            singleton_timer wait;
+            lock.lock();
+            singleton_record_wait<heap_singleton>(wait.elapsed());
+        }
+#else
+        lock_guard<mutex> lock(mu_);
+#endif
+        T* p = data_.load(memory_order_relaxed);
+        if (p == nullptr) {
+            // restore the flag, since a destructor run by `destroy`
+            // may re-create the instance
+            bool managed = managed_;
+            managed_ = true;
+            singleton_timer timer;
+            try {
+                p = construct(forward<Ts>(ts)...);
+            } catch (...) {
+                managed_ = managed;
+                throw;
             }
+            singleton_record_construction<heap_singleton>(timer.elapsed());
+            managed_ = managed;
+            data_.store(p, memory_order_release);
         }
         return *p;
     }
 
+    static
+    value_type&
+    instance()
+    noexcept
+    {
+        T* p = data_.load(memory_order_acquire);
+        assert(p != nullptr && "Singleton accessed before initialization.");
+        return *p;
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        value_type* tmp;
+        {
+            lock_guard<mutex> lock(mu_);
+            tmp = data_.exchange(nullptr, memory_order_acq_rel);
+        }
+        // destroy without holding the lock, so the destructor may
+        // access the singleton without deadlocking
+        if (tmp != nullptr) {
+            bool managed = managed_;
+            managed_ = true;
+            singleton_detail::heap_destroy<T, Allocator>(tmp, is_default());
+            managed_ = managed;
+        }
+    }
+
 protected:
     heap_singleton() = default;
     heap_singleton(const heap_singleton&) = delete;
@@ -171,27 +594,42 @@ protected:
 
     ~heap_singleton()
     {
-        // use temporary to avoid recursion
-        value_type* tmp = data_.load(memory_order_acquire);
-        data_.store(nullptr, memory_order_release);
-        delete tmp;
 #ifndef NDEBUG
-        assert(tmp != nullptr && "Singleton used outside of pattern.");
+        assert(managed_ && "Singleton used outside of pattern.");
 #endif
     }
 
 private:
     static atomic<value_type*> data_;
     static mutex mu_;
+    // whether the pattern is constructing or destroying the instance
+    // on this thread, since `destroy` runs outside of `mu_`
+    static thread_local bool managed_;
+
+    using is_default = singleton_detail::is_default_allocator<T, Allocator>;
+
+    template<typename ... Ts>
+    static
+    value_type*
+    construct(
+        Ts&&... ts
+    )
+    {
+        return singleton_detail::heap_construct<T, Allocator>(is_default(), forward<Ts>(ts)...);
+    }
 };
 
-template <typename T>
+template <typename T, typename Allocator>
 atomic<T*>
-heap_singleton<T, true>::data_ = ATOMIC_VAR_INIT(nullptr);
+heap_singleton<T, true, Allocator>::data_ = ATOMIC_VAR_INIT(nullptr);
 
-template <typename T>
+template <typename T, typename Allocator>
 mutex
-heap_singleton<T, true>::mu_;
+heap_singleton<T, true, Allocator>::mu_;
+
+template <typename T, typename Allocator>
+thread_local bool
+heap_singleton<T, true, Allocator>::managed_ = false;
 
 /**
  *  \brief Optionally thread-safe stack singleton pattern.
@@ -202,13 +640,16 @@ heap_singleton<T, true>::mu_;
  *  The stack singleton **must** known the type size prior to instantiation,
  *  since the CRTP works with incomplete types. For safety reasons,
  *  this assertion is checked in the destructor, leading to a compiler
- *  error if the wrong size or alignment is used.
+ *  error if the wrong size or alignment is used. With the
+ *  `storage_padded` policy, the storage may be larger than the type,
+ *  for example, to pad the instance to a full cache line.
  */
 template <
     typename T,
     size_t Size,
     size_t Alignment = alignof(max_align_t),
-    bool ThreadSafe = true
+    bool ThreadSafe = true,
+    storage_policy Policy = storage_exact
 >
 class stack_singleton;
 
@@ -216,9 +657,10 @@ class stack_singleton;
 template <
     typename T,
     size_t Size,
-    size_t Alignment
+    size_t Alignment,
+    storage_policy Policy
 >
-class stack_singleton<T, Size, Alignment, false>
+class stack_singleton<T, Size, Alignment, false, Policy>
 {
 public:
     static constexpr bool thread_safe = false;
@@ -229,17 +671,64 @@ public:
     static
     value_type&
     get(
-        Ts... ts
+        Ts&&... ts
+    )
+    {
+        singleton_record_access<stack_singleton>();
+        if (state_ != singleton_detail::singleton_initialized) {
+            return init(forward<Ts>(ts)...);
+        }
+        return reinterpret_cast<value_type&>(data_);
+    }
+
+    template<typename... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
     )
     {
+        using namespace singleton_detail;
+
         value_type& r = reinterpret_cast<value_type&>(data_);
-        if (!initialized_) {
-            new (&r) value_type(forward<Ts>(ts)...);
-            initialized_ = true;
+        if (state_ == singleton_uninitialized) {
+            state_ = singleton_initializing;
+            singleton_timer timer;
+            try {
+                new (&r) value_type(forward<Ts>(ts)...);
+            } catch (...) {
+                state_ = singleton_uninitialized;
+                throw;
+            }
+            singleton_record_construction<stack_singleton>(timer.elapsed());
+            state_ = singleton_initialized;
         }
         return r;
     }
 
+    static
+    value_type&
+    instance()
+    noexcept
+    {
+        assert(state_ == singleton_detail::singleton_initialized && "Singleton accessed before initialization.");
+        return reinterpret_cast<value_type&>(data_);
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        using namespace singleton_detail;
+
+        if (state_ == singleton_initialized) {
+            state_ = singleton_initializing;
+            reinterpret_cast<value_type&>(data_).~T();
+            state_ = singleton_uninitialized;
+        }
+    }
+
 protected:
     stack_singleton() = default;
     stack_singleton(const stack_singleton&) = delete;
@@ -247,39 +736,35 @@ protected:
 
     ~stack_singleton()
     {
-        // use a temporary to avoid recursion
-        pimp_detail::storage_asserter<T, Size, Alignment> {};
-        value_type& r = reinterpret_cast<value_type&>(data_);
-        bool tmp = initialized_;
-        initialized_ = false;
-        if (tmp) {
-            r.~T();
-        }
+        // the instance is only destroyed by `destroy`, or while
+        // unwinding from a throwing constructor in `init`
+        pimp_detail::storage_asserter<T, Size, Alignment, Policy> {};
 #ifndef NDEBUG
-        assert(tmp && "Singleton used outside of pattern.");
+        assert(state_ == singleton_detail::singleton_initializing && "Singleton used outside of pattern.");
 #endif
     }
 
 private:
     static storage_type data_;
-    static bool initialized_;
+    static int state_;
 };
 
-template <typename T, size_t Size, size_t Alignment>
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
 aligned_storage_t<Size, Alignment>
-stack_singleton<T, Size, Alignment, false>::data_;
+stack_singleton<T, Size, Alignment, false, Policy>::data_;
 
-template <typename T, size_t Size, size_t Alignment>
-bool
-stack_singleton<T, Size, Alignment, false>::initialized_ = false;
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+int
+stack_singleton<T, Size, Alignment, false, Policy>::state_ = singleton_detail::singleton_uninitialized;
 
 // Multi-threaded
 template <
     typename T,
     size_t Size,
-    size_t Alignment
+    size_t Alignment,
+    storage_policy Policy
 >
-class stack_singleton<T, Size, Alignment, true>
+class stack_singleton<T, Size, Alignment, true, Policy>
 {
 public:
     static constexpr bool thread_safe = true;
@@ -290,18 +775,77 @@ public:
     static
     value_type&
     get(
-        Ts... ts
+        Ts&&... ts
     )
     {
-        value_type& r = reinterpret_cast<value_type&>(data_);
-        if (!initialized_.load()) {
-            lock_guard<mutex> lock(mu_);
-            if (!initialized_.load()) {
-                new (&r) value_type(forward<Ts>(ts)...);
-                initialized_.store(true, memory_order_release);
+        singleton_record_access<stack_singleton>();
+        if (state_.load(memory_order_acquire) != singleton_detail::singleton_initialized) {
+            return init(forward<Ts>(ts)...);
+        }
+        return reinterpret_cast<value_type&>(data_);
+    }
+
+    template<typename... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+        using namespace singleton_detail;
+
+        int s = singleton_uninitialized;
+        while (s != singleton_initialized) {
+            if (state_.compare_exchange_strong(s, singleton_initializing, memory_order_acquire)) {
+                // reset the state if construction throws, so another
+                // thread may retry initialization
+                singleton_timer timer;
+                try {
+                    new (&data_) value_type(forward<Ts>(ts)...);
+                } catch (...) {
+                    publish_state(state_, singleton_uninitialized);
+                    throw;
+                }
+                singleton_record_construction<stack_singleton>(timer.elapsed());
+                publish_state(state_, singleton_initialized);
+                break;
+            } else if (s == singleton_initializing) {
+                singleton_timer wait;
+                s = wait_initializing(state_);
+                singleton_record_wait<stack_singleton>(wait.elapsed());
             }
         }
-        return r;
+        return reinterpret_cast<value_type&>(data_);
+    }
+
+    // The instance must have been initialized by a call which
+    // happens-before this one, for example, before starting the
+    // threads accessing it.
+    static
+    value_type&
+    instance()
+    noexcept
+    {
+        assert(state_.load(memory_order_relaxed) == singleton_detail::singleton_initialized && "Singleton accessed before initialization.");
+        return reinterpret_cast<value_type&>(data_);
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {
+        using namespace singleton_detail;
+
+        // hold the initializing state while destroying, so the state
+        // is never initialized for a destroyed instance. References
+        // obtained earlier are not protected, so this must still not
+        // run concurrently with any other access.
+        int s = singleton_initialized;
+        if (state_.compare_exchange_strong(s, singleton_initializing, memory_order_acquire)) {
+            reinterpret_cast<value_type&>(data_).~T();
+            publish_state(state_, singleton_uninitialized);
+        }
     }
 
 protected:
@@ -311,34 +855,459 @@ protected:
 
     ~stack_singleton()
     {
-        pimp_detail::storage_asserter<T, Size, Alignment> {};
-        value_type& r = reinterpret_cast<value_type&>(data_);
-        bool tmp = initialized_.load(memory_order_acquire);
-        initialized_.store(false, memory_order_release);
-        if (tmp) {
-            r.~T();
-        }
+        // the instance is only destroyed by `destroy`, or while
+        // unwinding from a throwing constructor in `init`
+        pimp_detail::storage_asserter<T, Size, Alignment, Policy> {};
 #ifndef NDEBUG
-        assert(tmp && "Singleton used outside of pattern.");
+        assert(state_.load(memory_order_relaxed) == singleton_detail::singleton_initializing && "Singleton used outside of pattern.");
 #endif
     }
 
 private:
     static storage_type data_;
-    static atomic<bool> initialized_;
-    static mutex mu_;
+    static atomic<int> state_;
 };
 
-template <typename T, size_t Size, size_t Alignment>
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
 aligned_storage_t<Size, Alignment>
-stack_singleton<T, Size, Alignment, true>::data_;
+stack_singleton<T, Size, Alignment, true, Policy>::data_;
+
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+atomic<int>
+stack_singleton<T, Size, Alignment, true, Policy>::state_ = ATOMIC_VAR_INIT(singleton_detail::singleton_uninitialized);
+
+// ALIAS
+
+template <typename T, size_t Size, size_t Alignment = cache_line_size, bool ThreadSafe = true>
+using padded_stack_singleton = stack_singleton<T, Size, Alignment, ThreadSafe, storage_padded>;
+
+/**
+ *  \brief Singleton pattern constant-initialized at compile time.
+ *
+ *  The instance is a static member of the derived type, so it is only
+ *  instantiated once the type is complete. Since the destructor must
+ *  be trivial, the instance is never destroyed, and `destroy` is a
+ *  no-op, provided for use with `singleton_registry`. The instance is
+ *  mutable, but concurrent modification must be synchronized.
+ *
+ *  A trivial destructor cannot assert, so in debug builds, the
+ *  constructor asserts if it runs outside of constant initialization,
+ *  which requires `constinit` and `is_constant_evaluated`, and is not
+ *  checked before C++20.
+ */
+template <typename T>
+class constant_singleton
+{
+public:
+    using value_type = T;
+
+    static
+    constexpr
+    value_type&
+    get()
+    noexcept
+    {
+        static_assert(is_trivially_destructible<T>::value, "Constant singletons must be trivially destructible.");
+        return data_;
+    }
+
+    static
+    constexpr
+    value_type&
+    instance()
+    noexcept
+    {
+        return get();
+    }
+
+    static
+    void
+    destroy()
+    noexcept
+    {}
+
+protected:
+    // the destructor is implicit, so the derived type may be
+    // trivially destructible, and the pattern is checked on
+    // construction instead: with `constinit`, only the static
+    // instance is constructed during constant initialization
+#if !defined(NDEBUG) && defined(__cpp_constinit) && defined(__cpp_lib_is_constant_evaluated)
+    constexpr
+    constant_singleton()
+    noexcept
+    {
+        assert(is_constant_evaluated() && "Singleton used outside of pattern.");
+    }
+#else
+    constexpr constant_singleton() noexcept = default;
+#endif
+    constant_singleton(const constant_singleton&) = delete;
+    constant_singleton& operator=(const constant_singleton&) = delete;
+
+private:
+    static value_type data_;
+};
+
+#if defined(__cpp_constinit)
+template <typename T>
+constinit T
+constant_singleton<T>::data_;
+#elif defined(__clang__)
+template <typename T>
+[[clang::require_constant_initialization]] T
+constant_singleton<T>::data_;
+#else
+template <typename T>
+T
+constant_singleton<T>::data_;
+#endif
+
+/**
+ *  \brief Singleton pattern with one instance per thread.
+ *
+ *  Each thread lazily constructs its own instance, which is destroyed
+ *  on thread exit. `for_each` visits every live instance while
+ *  holding the registry lock, which prevents threads from creating
+ *  or destroying their instance, but does not synchronize with the
+ *  owning threads using it: the visited data must be atomic or
+ *  otherwise synchronized, for example, statistics counters.
+ *
+ *  Accessing the instance after it was destroyed on thread exit, for
+ *  example, from the destructor of a later-destroyed `thread_local`,
+ *  throws `logic_error`.
+ */
+template <typename T>
+class thread_local_singleton
+{
+public:
+    using value_type = T;
+
+    template<typename... Ts>
+    static
+    value_type&
+    get(
+        Ts&&... ts
+    )
+    {
+        if (!exited()) {
+            holder& h = local();
+            if (h.data_ != nullptr) {
+                return *h.data_;
+            }
+        }
+        return init(forward<Ts>(ts)...);
+    }
+
+    template<typename... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+        if (exited()) {
+            // never link a destroyed holder into the registry
+            throw logic_error("Thread-local singleton accessed after thread exit.");
+        }
+        holder& h = local();
+        if (h.data_ == nullptr) {
+            h.data_ = new value_type(forward<Ts>(ts)...);
+            lock_guard<mutex> lock(mu_);
+            h.next_ = head_;
+            if (head_ != nullptr) {
+                head_->prev_ = &h;
+            }
+            head_ = &h;
+        }
+        return *h.data_;
+    }
+
+    static
+    value_type&
+    instance()
+    noexcept
+    {
+        assert(!exited() && local().data_ != nullptr && "Singleton accessed before initialization.");
+        return *local().data_;
+    }
+
+    template <typename Function>
+    static
+    void
+    for_each(
+        Function f
+    )
+    {
+        lock_guard<mutex> lock(mu_);
+        for (holder* h = head_; h != nullptr; h = h->next_) {
+            f(*h->data_);
+        }
+    }
+
+protected:
+    thread_local_singleton() = default;
+    thread_local_singleton(const thread_local_singleton&) = delete;
+    thread_local_singleton& operator=(const thread_local_singleton&) = delete;
+
+    ~thread_local_singleton()
+    {
+#ifndef NDEBUG
+        assert(!exited() && local().destroying_ && "Singleton used outside of pattern.");
+#endif
+    }
+
+private:
+    struct holder
+    {
+        value_type* data_ = nullptr;
+        holder* prev_ = nullptr;
+        holder* next_ = nullptr;
+        bool destroying_ = false;
+
+        ~holder()
+        {
+            if (data_ == nullptr) {
+                exited() = true;
+                return;
+            }
+            {
+                lock_guard<mutex> lock(mu_);
+                if (prev_ != nullptr) {
+                    prev_->next_ = next_;
+                } else {
+                    head_ = next_;
+                }
+                if (next_ != nullptr) {
+                    next_->prev_ = prev_;
+                }
+            }
+            // use temporary to avoid recursion
+            value_type* tmp = data_;
+            data_ = nullptr;
+            destroying_ = true;
+            delete tmp;
+            exited() = true;
+        }
+    };
+
+    static holder* head_;
+    static mutex mu_;
+
+    // Trivially destructible, so it remains valid after the holder
+    // is destroyed on thread exit.
+    static
+    bool&
+    exited()
+    noexcept
+    {
+        static thread_local bool flag = false;
+        return flag;
+    }
 
-template <typename T, size_t Size, size_t Alignment>
-atomic<bool>
-stack_singleton<T, Size, Alignment, true>::initialized_ = ATOMIC_VAR_INIT(false);
+    // Must not be called once `exited()`.
+    static
+    holder&
+    local()
+    noexcept
+    {
+        static thread_local holder h;
+        return h;
+    }
+};
+
+template <typename T>
+typename thread_local_singleton<T>::holder*
+thread_local_singleton<T>::head_ = nullptr;
 
-template <typename T, size_t Size, size_t Alignment>
+template <typename T>
 mutex
-stack_singleton<T, Size, Alignment, true>::mu_;
+thread_local_singleton<T>::mu_;
+
+/**
+ *  \brief Method used to select the shard of the calling thread.
+ *
+ *  `shard_by_cpu` uses the current CPU where supported, and otherwise
+ *  falls back to `shard_by_thread`, which assigns shards to threads
+ *  in a round-robin order.
+ */
+enum shard_policy
+{
+    shard_by_thread,
+    shard_by_cpu,
+};
+
+/**
+ *  \brief Thread-safe singleton pattern with a fixed number of shards.
+ *
+ *  Like `stack_singleton`, the type size **must** be known prior to
+ *  instantiation. Each shard is stored in aligned storage padded to
+ *  `Alignment`, so adjacent shards never share a cache line. All shards
+ *  are constructed from the same arguments on first access.
+ */
+template <
+    typename T,
+    size_t Size,
+    size_t Shards,
+    size_t Alignment = cache_line_size,
+    shard_policy Policy = shard_by_thread
+>
+class sharded_singleton
+{
+public:
+    static_assert(Shards > 0, "Must have at least one shard.");
+
+    static constexpr size_t shards = Shards;
+    using value_type = T;
+    using storage_type = aligned_storage_t<Size, Alignment>;
+
+    template<typename... Ts>
+    static
+    value_type&
+    get(
+        Ts&&... ts
+    )
+    {
+        if (state_.load(memory_order_acquire) != singleton_detail::singleton_initialized) {
+            init(forward<Ts>(ts)...);
+        }
+        return shard(shard_index());
+    }
+
+    template<typename... Ts>
+    static
+    value_type&
+    init(
+        Ts&&... ts
+    )
+    {
+        using namespace singleton_detail;
+        pimp_detail::storage_asserter<T, Size, Alignment> {};
+
+        int s = singleton_uninitialized;
+        while (s != singleton_initialized) {
+            if (state_.compare_exchange_strong(s, singleton_initializing, memory_order_acquire)) {
+                size_t i = 0;
+                try {
+                    for (; i < Shards; ++i) {
+                        new (&data_[i]) value_type(ts...);
+                    }
+                } catch (...) {
+                    while (i-- > 0) {
+                        shard(i).~T();
+                    }
+                    publish_state(state_, singleton_uninitialized);
+                    throw;
+                }
+                publish_state(state_, singleton_initialized);
+                break;
+            }
+            s = wait_initializing(state_);
+        }
+        return shard(shard_index());
+    }
+
+    static
+    value_type&
+    shard(
+        size_t index
+    )
+    noexcept
+    {
+        assert(index < Shards);
+        return reinterpret_cast<value_type&>(data_[index]);
+    }
+
+    static
+    size_t
+    shard_index()
+    noexcept
+    {
+        return shard_index(integral_constant<shard_policy, Policy>());
+    }
+
+    template <typename Function>
+    static
+    void
+    for_each_shard(
+        Function f
+    )
+    {
+        for (size_t i = 0; i < Shards; ++i) {
+            f(shard(i));
+        }
+    }
+
+    template <typename U, typename BinaryFunction>
+    static
+    U
+    reduce(
+        U init,
+        BinaryFunction f
+    )
+    {
+        for (size_t i = 0; i < Shards; ++i) {
+            init = f(move(init), static_cast<const value_type&>(shard(i)));
+        }
+        return init;
+    }
+
+protected:
+    sharded_singleton() = default;
+    sharded_singleton(const sharded_singleton&) = delete;
+    sharded_singleton& operator=(const sharded_singleton&) = delete;
+
+    ~sharded_singleton()
+    {
+        pimp_detail::storage_asserter<T, Size, Alignment> {};
+#ifndef NDEBUG
+        const void* p = static_cast<const void*>(this);
+        bool owned = p >= static_cast<const void*>(data_) && p < static_cast<const void*>(data_ + Shards);
+        assert(owned && "Singleton used outside of pattern.");
+#endif
+    }
+
+private:
+    static storage_type data_[Shards];
+    static atomic<int> state_;
+
+    static
+    size_t
+    shard_index(
+        integral_constant<shard_policy, shard_by_thread>
+    )
+    noexcept
+    {
+        static atomic<size_t> counter = ATOMIC_VAR_INIT(0);
+        static thread_local size_t index = counter.fetch_add(1, memory_order_relaxed) % Shards;
+        return index;
+    }
+
+    static
+    size_t
+    shard_index(
+        integral_constant<shard_policy, shard_by_cpu>
+    )
+    noexcept
+    {
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return static_cast<size_t>(cpu) % Shards;
+        }
+#endif
+        return shard_index(integral_constant<shard_policy, shard_by_thread>());
+    }
+};
+
+template <typename T, size_t Size, size_t Shards, size_t Alignment, shard_policy Policy>
+const size_t sharded_singleton<T, Size, Shards, Alignment, Policy>::shards;
+
+template <typename T, size_t Size, size_t Shards, size_t Alignment, shard_policy Policy>
+aligned_storage_t<Size, Alignment>
+sharded_singleton<T, Size, Shards, Alignment, Policy>::data_[Shards];
+
+template <typename T, size_t Size, size_t Shards, size_t Alignment, shard_policy Policy>
+atomic<int>
+sharded_singleton<T, Size, Shards, Alignment, Policy>::state_ = ATOMIC_VAR_INIT(singleton_detail::singleton_uninitialized);
 
 PYCPP_END_NAMESPACE
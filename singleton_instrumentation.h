@@ -0,0 +1,251 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Optional contention and latency instrumentation for singletons.
+ *
+ *  When `USE_SINGLETON_INSTRUMENTATION` is defined, the heap and stack
+ *  singletons record, per singleton class, the number of accesses
+ *  through `get`, the number of constructions and the time spent
+ *  constructing, and the number of accesses which blocked while
+ *  another thread initialized the instance, with the total time spent
+ *  blocked. The counters are keyed by the singleton class, such as
+ *  `heap_singleton<T>`, rather than by `T`, so the same type managed
+ *  by different patterns is counted separately. `singleton_snapshot`
+ *  returns the statistics for every class recorded so far. Times are
+ *  in nanoseconds, from `steady_clock`.
+ *
+ *  Every access increments a relaxed atomic shared by all threads,
+ *  which is enough to compare call counts, but adds contention to
+ *  heavily accessed singletons. When undefined, every hook is an
+ *  empty inline function, and the timers hold no state, so the
+ *  singletons compile to the same code as without instrumentation.
+ *
+ *  \synopsis
+ *      struct singleton_statistics
+ *      {
+ *          const char* name;
+ *          size_t accesses;
+ *          size_t constructions;
+ *          uint64_t construction_ns;
+ *          size_t contended;
+ *          uint64_t wait_ns;
+ *      };
+ *
+ *      class singleton_timer
+ *      {
+ *      public:
+ *          singleton_timer() noexcept;
+ *          uint64_t elapsed() const noexcept;
+ *      };
+ *
+ *      template <typename Singleton> void singleton_record_access() noexcept;
+ *      template <typename Singleton> void singleton_record_construction(uint64_t ns) noexcept;
+ *      template <typename Singleton> void singleton_record_wait(uint64_t ns) noexcept;
+ *
+ *      vector<singleton_statistics> singleton_snapshot();
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/adaptor/pimpl_instrumentation.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/cstdint.h>
+#include <pycpp/stl/vector.h>
+
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+#   include <pycpp/stl/chrono.h>
+#endif
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Snapshot of the counters for a single singleton class.
+ */
+struct singleton_statistics
+{
+    const char* name;
+    size_t accesses;
+    size_t constructions;
+    uint64_t construction_ns;
+    size_t contended;
+    uint64_t wait_ns;
+};
+
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+
+namespace instrument_detail
+{
+// DETAIL
+// ------
+
+struct singleton_counters;
+
+inline
+atomic<singleton_counters*>&
+singleton_list()
+noexcept
+{
+    static atomic<singleton_counters*> head(nullptr);
+    return head;
+}
+
+
+struct singleton_counters
+{
+    const char* name;
+    atomic<size_t> accesses;
+    atomic<size_t> constructions;
+    atomic<uint64_t> construction_ns;
+    atomic<size_t> contended;
+    atomic<uint64_t> wait_ns;
+    singleton_counters* next;
+
+    singleton_counters(
+        const char* n
+    )
+    noexcept:
+        name(n),
+        accesses(0),
+        constructions(0),
+        construction_ns(0),
+        contended(0),
+        wait_ns(0),
+        next(nullptr)
+    {
+        // counters are never removed, so pushing is ABA-safe
+        atomic<singleton_counters*>& head = singleton_list();
+        next = head.load(memory_order_relaxed);
+        while (!head.compare_exchange_weak(next, this, memory_order_release, memory_order_relaxed))
+        {}
+    }
+};
+
+
+template <typename Singleton>
+inline
+singleton_counters&
+singleton_counters_of()
+noexcept
+{
+    static singleton_counters c(type_name<Singleton>());
+    return c;
+}
+
+}   /* instrument_detail */
+
+#endif                                          // USE_SINGLETON_INSTRUMENTATION
+
+/**
+ *  \brief Measure the time since construction, when instrumented.
+ */
+class singleton_timer
+{
+public:
+    singleton_timer()
+    noexcept
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+        : start_(chrono::steady_clock::now())
+#endif
+    {}
+
+    uint64_t
+    elapsed()
+    const noexcept
+    {
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+        auto d = chrono::steady_clock::now() - start_;
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count());
+#else
+        return 0;
+#endif
+    }
+
+private:
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+    chrono::steady_clock::time_point start_;
+#endif
+};
+
+// FUNCTIONS
+// ---------
+
+template <typename Singleton>
+inline
+void
+singleton_record_access()
+noexcept
+{
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+    instrument_detail::singleton_counters_of<Singleton>().accesses.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+
+template <typename Singleton>
+inline
+void
+singleton_record_construction(
+    uint64_t ns
+)
+noexcept
+{
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+    instrument_detail::singleton_counters& c = instrument_detail::singleton_counters_of<Singleton>();
+    c.constructions.fetch_add(1, memory_order_relaxed);
+    c.construction_ns.fetch_add(ns, memory_order_relaxed);
+#else
+    (void) ns;
+#endif
+}
+
+
+template <typename Singleton>
+inline
+void
+singleton_record_wait(
+    uint64_t ns
+)
+noexcept
+{
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+    instrument_detail::singleton_counters& c = instrument_detail::singleton_counters_of<Singleton>();
+    c.contended.fetch_add(1, memory_order_relaxed);
+    c.wait_ns.fetch_add(ns, memory_order_relaxed);
+#else
+    (void) ns;
+#endif
+}
+
+
+/**
+ *  \brief Get the current statistics for every instrumented singleton.
+ */
+inline
+vector<singleton_statistics>
+singleton_snapshot()
+{
+    vector<singleton_statistics> v;
+#if defined(USE_SINGLETON_INSTRUMENTATION)
+    using instrument_detail::singleton_counters;
+    singleton_counters* c = instrument_detail::singleton_list().load(memory_order_acquire);
+    for (; c != nullptr; c = c->next) {
+        singleton_statistics s;
+        s.name = c->name;
+        s.accesses = c->accesses.load(memory_order_relaxed);
+        s.constructions = c->constructions.load(memory_order_relaxed);
+        s.construction_ns = c->construction_ns.load(memory_order_relaxed);
+        s.contended = c->contended.load(memory_order_relaxed);
+        s.wait_ns = c->wait_ns.load(memory_order_relaxed);
+        v.push_back(s);
+    }
+#endif
+    return v;
+}
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,348 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Registry for eager initialization and ordered teardown of singletons.
+ *
+ *  Singletons registered with their dependencies can be constructed
+ *  ahead of the first access with `warm_up`, which constructs
+ *  independent singletons concurrently on a set of worker threads,
+ *  one dependency level at a time, so every dependency is constructed
+ *  before its dependents. `shutdown` destroys every registered
+ *  singleton in the reverse order, so no singleton outlives one it
+ *  depends on. The registry calls `shutdown` when it is destroyed,
+ *  and leaves the singletons alive if it runs out of memory ordering
+ *  them.
+ *
+ *  Any singleton with a static `get()`, constructing the instance from
+ *  no arguments, and a static `destroy()`, such as `heap_singleton` and
+ *  `stack_singleton`, may be registered. Dependencies which are not
+ *  registered are ignored. `warm_up` throws `logic_error` on cyclic
+ *  dependencies, before constructing any singleton, while `shutdown`
+ *  destroys the singletons on or depending on a cycle first, in the
+ *  reverse order of registration.
+ *
+ *  The registry lock is not held while constructing or destroying the
+ *  singletons, so their constructors may register other singletons,
+ *  which are constructed by a later `warm_up`.
+ *
+ *  If a constructor throws during `warm_up`, the remaining singletons
+ *  of the level are still constructed, and the first exception is
+ *  rethrown once the workers finish. `shutdown` must not run
+ *  concurrently with any access to the singletons.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/singleton_registry.h>
+ *
+ *      struct config: heap_singleton<config> {};
+ *      struct database: heap_singleton<database> {};   // reads `config`
+ *
+ *      int main()
+ *      {
+ *          singleton_registry& registry = singleton_registry::global();
+ *          registry.add<config>();
+ *          registry.add<database, config>();
+ *          registry.warm_up();
+ *      }
+ *
+ *  \synopsis
+ *      class singleton_registry
+ *      {
+ *      public:
+ *          singleton_registry() = default;
+ *          singleton_registry(const singleton_registry&) = delete;
+ *          singleton_registry& operator=(const singleton_registry&) = delete;
+ *          ~singleton_registry();
+ *
+ *          static singleton_registry& global();
+ *
+ *          template <typename Singleton, typename ... Dependencies>
+ *          void add();
+ *
+ *          void warm_up(size_t threads = 0);
+ *          void shutdown();
+ *      };
+ */
+
+#pragma once
+
+#include <pycpp/config.h>
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/exception.h>
+#include <pycpp/stl/mutex.h>
+#include <pycpp/stl/stdexcept.h>
+#include <pycpp/stl/thread.h>
+#include <pycpp/stl/vector.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace singleton_detail
+{
+// DETAIL
+// ------
+
+using registry_key = const void*;
+
+// Unique address for each type, without requiring RTTI.
+template <typename T>
+inline
+registry_key
+registry_key_of()
+noexcept
+{
+    static const char key = 0;
+    return &key;
+}
+
+
+template <typename Singleton>
+void
+registry_init()
+{
+    Singleton::get();
+}
+
+
+template <typename Singleton>
+void
+registry_destroy()
+noexcept
+{
+    Singleton::destroy();
+}
+
+}   /* singleton_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Dependency-ordered registry of singletons.
+ */
+class singleton_registry
+{
+public:
+    singleton_registry() = default;
+    singleton_registry(const singleton_registry&) = delete;
+    singleton_registry& operator=(const singleton_registry&) = delete;
+
+    ~singleton_registry()
+    {
+        // the singletons outlive a registry which cannot order them,
+        // as if it was never shut down
+        try {
+            shutdown();
+        } catch (...) {
+        }
+    }
+
+    static
+    singleton_registry&
+    global()
+    {
+        static singleton_registry registry;
+        return registry;
+    }
+
+    template <typename Singleton, typename ... Dependencies>
+    void
+    add()
+    {
+        using namespace singleton_detail;
+
+        entry e;
+        e.key = registry_key_of<Singleton>();
+        e.init = &registry_init<Singleton>;
+        e.destroy = &registry_destroy<Singleton>;
+        e.dependencies = {registry_key_of<Dependencies>()...};
+
+        lock_guard<mutex> lock(mu_);
+        for (const entry& x: entries_) {
+            if (x.key == e.key) {
+                return;
+            }
+        }
+        entries_.push_back(move(e));
+    }
+
+    // Construct every registered singleton, using `threads` workers,
+    // or one worker per hardware thread if 0.
+    void
+    warm_up(
+        size_t threads = 0
+    )
+    {
+        if (threads == 0) {
+            threads = thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+
+        vector<entry> entries = snapshot();
+        vector<const entry*> cyclic;
+        vector<vector<const entry*>> levels = order(entries, cyclic);
+        if (!cyclic.empty()) {
+            throw logic_error("Cyclic singleton dependencies.");
+        }
+
+        exception_ptr error;
+        for (const vector<const entry*>& level: levels) {
+            run_level(level, threads, error);
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+    }
+
+    // Destroy every registered singleton, dependents first. Throws
+    // `bad_alloc` before destroying any singleton if the order cannot
+    // be computed.
+    void
+    shutdown()
+    {
+        vector<entry> entries = snapshot();
+        vector<const entry*> cyclic;
+        vector<vector<const entry*>> levels = order(entries, cyclic);
+
+        // dependents of a cycle are not ordered either, so destroy
+        // them, and the cycle, before every ordered entry
+        for (size_t i = cyclic.size(); i-- > 0;) {
+            cyclic[i]->destroy();
+        }
+        for (size_t i = levels.size(); i-- > 0;) {
+            const vector<const entry*>& level = levels[i];
+            for (size_t j = level.size(); j-- > 0;) {
+                level[j]->destroy();
+            }
+        }
+    }
+
+private:
+    struct entry
+    {
+        singleton_detail::registry_key key;
+        void (*init)();
+        void (*destroy)();
+        vector<singleton_detail::registry_key> dependencies;
+    };
+
+    vector<entry> entries_;
+    mutex mu_;
+
+    // Copy the entries, so the lock is released before calling
+    // into the singletons.
+    vector<entry>
+    snapshot()
+    {
+        lock_guard<mutex> lock(mu_);
+        return entries_;
+    }
+
+    // Group the entries into levels, where each entry only depends
+    // on entries from earlier levels. Entries which cannot be ordered,
+    // on or depending on a cycle, are added to `cyclic`.
+    static
+    vector<vector<const entry*>>
+    order(
+        const vector<entry>& entries,
+        vector<const entry*>& cyclic
+    )
+    {
+        size_t n = entries.size();
+        vector<size_t> level(n, 0);
+        vector<bool> done(n, false);
+        size_t remaining = n;
+        size_t depth = 0;
+        while (remaining != 0) {
+            vector<size_t> ready;
+            for (size_t i = 0; i < n; ++i) {
+                if (!done[i] && dependencies_done(entries, entries[i], done)) {
+                    ready.push_back(i);
+                }
+            }
+            if (ready.empty()) {
+                break;
+            }
+            for (size_t i: ready) {
+                done[i] = true;
+                level[i] = depth;
+            }
+            remaining -= ready.size();
+            ++depth;
+        }
+
+        vector<vector<const entry*>> levels(depth);
+        for (size_t i = 0; i < n; ++i) {
+            if (done[i]) {
+                levels[level[i]].push_back(&entries[i]);
+            } else {
+                cyclic.push_back(&entries[i]);
+            }
+        }
+        return levels;
+    }
+
+    static
+    bool
+    dependencies_done(
+        const vector<entry>& entries,
+        const entry& e,
+        const vector<bool>& done
+    )
+    noexcept
+    {
+        for (singleton_detail::registry_key key: e.dependencies) {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].key == key && !done[i]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static
+    void
+    run_level(
+        const vector<const entry*>& level,
+        size_t threads,
+        exception_ptr& error
+    )
+    {
+        atomic<size_t> next(0);
+        mutex error_mutex;
+        auto work = [&]() {
+            for (size_t i = next++; i < level.size(); i = next++) {
+                try {
+                    level[i]->init();
+                } catch (...) {
+                    lock_guard<mutex> lock(error_mutex);
+                    if (!error) {
+                        error = current_exception();
+                    }
+                }
+            }
+        };
+
+        // the calling thread is one of the workers, and if a thread
+        // cannot be started, the workers already running finish the
+        // level without it
+        size_t count = threads < level.size() ? threads : level.size();
+        vector<thread> workers;
+        try {
+            workers.reserve(count);
+            for (size_t i = 1; i < count; ++i) {
+                workers.emplace_back(work);
+            }
+        } catch (...) {
+        }
+        work();
+        for (thread& t: workers) {
+            t.join();
+        }
+    }
+};
+
+PYCPP_END_NAMESPACE
@@ -0,0 +1,383 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Fixed-size slab allocator for heap PIMPL wrappers.
+ *
+ *  Allocator handing out single objects of a fixed size from
+ *  large slabs, designed to be used as the `Allocator` of
+ *  `unique_heap_pimpl` or with the allocator overloads of
+ *  `shared_heap_pimpl`, for types that are created and destroyed
+ *  frequently.
+ *
+ *  Each thread keeps a local free-list of blocks, so allocation and
+ *  deallocation do not synchronize in the common case. When the local
+ *  list is exhausted, the thread takes every block returned to the
+ *  global free-list with a single atomic exchange, and only allocates
+ *  a new slab if the global list is empty. Threads holding too many
+ *  free blocks return half of them to the global list, so memory
+ *  freed on one thread can be reused on another. Slabs are never
+ *  returned to the system. Once the thread's local list is destroyed
+ *  on thread exit, for example, when a `thread_local` or static
+ *  wrapper is destroyed later, blocks are allocated from, and returned
+ *  directly to, the global list.
+ *
+ *  The allocator is stateless, and `is_always_equal`, so swapping
+ *  and moving the heap PIMPL wrappers never compares allocators.
+ *  Only requests for a single object use the slab: arrays are
+ *  forwarded to the global `operator new`.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/heap_pimpl.h>
+ *      #include <pycpp/adaptor/slab_allocator.h>
+ *
+ *      struct file_impl;
+ *      struct file
+ *      {
+ *      public:
+ *      private:
+ *          unique_heap_pimpl<file_impl, slab_allocator<file_impl>> impl_;
+ *      };
+ *
+ *  \synopsis
+ *      template <typename T>
+ *      class slab_allocator
+ *      {
+ *      public:
+ *          using value_type = T;
+ *          using size_type = size_t;
+ *          using difference_type = ptrdiff_t;
+ *          using propagate_on_container_copy_assignment = true_type;
+ *          using propagate_on_container_move_assignment = true_type;
+ *          using propagate_on_container_swap = true_type;
+ *          using is_always_equal = true_type;
+ *
+ *          slab_allocator() noexcept;
+ *          slab_allocator(const slab_allocator&) noexcept;
+ *          template <typename U> slab_allocator(const slab_allocator<U>&) noexcept;
+ *          slab_allocator& operator=(const slab_allocator&) noexcept;
+ *
+ *          value_type* allocate(size_type n);
+ *          void deallocate(value_type* p, size_type n) noexcept;
+ *      };
+ *
+ *      template <typename T, typename U>
+ *      bool operator==(const slab_allocator<T>&, const slab_allocator<U>&) noexcept;
+ *
+ *      template <typename T, typename U>
+ *      bool operator!=(const slab_allocator<T>&, const slab_allocator<U>&) noexcept;
+ */
+
+#pragma once
+
+#include <pycpp/stl/atomic.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/type_traits.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+namespace slab_detail
+{
+// DETAIL
+// ------
+
+struct slab_node
+{
+    slab_node* next;
+};
+
+
+constexpr
+size_t
+slab_max(
+    size_t x,
+    size_t y
+)
+noexcept
+{
+    return x < y ? y : x;
+}
+
+
+/**
+ *  \brief Global pool of blocks of a given size and alignment.
+ *
+ *  The pool is shared by every type with the same block layout,
+ *  including types rebound by `allocate_shared`.
+ */
+template <size_t Size, size_t Alignment>
+class slab_pool
+{
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t alignment = slab_max(Alignment, alignof(slab_node));
+    static constexpr size_t block_size = (slab_max(Size, sizeof(slab_node)) + alignment - 1) / alignment * alignment;
+    static constexpr size_t slab_size = 64 * 1024;
+    static constexpr size_t slab_count = slab_max(slab_size / block_size, 1);
+    static constexpr size_t cache_count = 64;
+
+    static_assert(alignment <= alignof(max_align_t), "Slab alignment must not exceed the global operator new.");
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    static
+    void*
+    allocate()
+    {
+        cache* c = local();
+        if (c == nullptr) {
+            // popping a single node from the global list is prone
+            // to ABA, so allocate a block which joins the pool once
+            // deallocated
+            return ::operator new(block_size);
+        }
+        if (c->head == nullptr) {
+            refill(*c);
+        }
+        slab_node* node = c->head;
+        c->head = node->next;
+        --c->count;
+        return node;
+    }
+
+    static
+    void
+    deallocate(
+        void* p
+    )
+    noexcept
+    {
+        slab_node* node = static_cast<slab_node*>(p);
+        cache* c = local();
+        if (c == nullptr) {
+            push(node, node);
+            return;
+        }
+        node->next = c->head;
+        c->head = node;
+        if (++c->count >= 2 * cache_count) {
+            release(*c, cache_count);
+        }
+    }
+
+private:
+    struct cache
+    {
+        slab_node* head = nullptr;
+        size_t count = 0;
+
+        ~cache()
+        {
+            // return the blocks to the global list on thread exit
+            if (head != nullptr) {
+                release(*this, count);
+            }
+            destroyed() = true;
+        }
+    };
+
+    static atomic<slab_node*> free_;
+
+    // Trivially destructible, so it remains valid after the cache
+    // is destroyed on thread exit.
+    static
+    bool&
+    destroyed()
+    noexcept
+    {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    // Local list of the calling thread, or null once destroyed.
+    static
+    cache*
+    local()
+    noexcept
+    {
+        if (destroyed()) {
+            return nullptr;
+        }
+        static thread_local cache c;
+        return &c;
+    }
+
+    static
+    void
+    refill(
+        cache& c
+    )
+    {
+        // take the entire global list, which avoids the ABA problem
+        // since nodes are never popped individually
+        slab_node* head = free_.exchange(nullptr, memory_order_acquire);
+        if (head != nullptr) {
+            size_t count = 0;
+            for (slab_node* node = head; node != nullptr; node = node->next) {
+                ++count;
+            }
+            c.head = head;
+            c.count = count;
+            return;
+        }
+
+        char* slab = static_cast<char*>(::operator new(slab_count * block_size));
+        for (size_t i = 0; i < slab_count; ++i) {
+            slab_node* node = reinterpret_cast<slab_node*>(slab + i * block_size);
+            node->next = i + 1 < slab_count
+                ? reinterpret_cast<slab_node*>(slab + (i + 1) * block_size)
+                : nullptr;
+        }
+        c.head = reinterpret_cast<slab_node*>(slab);
+        c.count = slab_count;
+    }
+
+    static
+    void
+    release(
+        cache& c,
+        size_t count
+    )
+    noexcept
+    {
+        slab_node* head = c.head;
+        slab_node* tail = head;
+        for (size_t i = 1; i < count; ++i) {
+            tail = tail->next;
+        }
+        c.head = tail->next;
+        c.count -= count;
+        push(head, tail);
+    }
+
+    // Push the list from `head` to `tail` onto the global list.
+    static
+    void
+    push(
+        slab_node* head,
+        slab_node* tail
+    )
+    noexcept
+    {
+        slab_node* expected = free_.load(memory_order_relaxed);
+        do {
+            tail->next = expected;
+        } while (!free_.compare_exchange_weak(expected, head, memory_order_release, memory_order_relaxed));
+    }
+};
+
+template <size_t Size, size_t Alignment>
+const size_t slab_pool<Size, Alignment>::alignment;
+
+template <size_t Size, size_t Alignment>
+const size_t slab_pool<Size, Alignment>::block_size;
+
+template <size_t Size, size_t Alignment>
+const size_t slab_pool<Size, Alignment>::slab_size;
+
+template <size_t Size, size_t Alignment>
+const size_t slab_pool<Size, Alignment>::slab_count;
+
+template <size_t Size, size_t Alignment>
+const size_t slab_pool<Size, Alignment>::cache_count;
+
+template <size_t Size, size_t Alignment>
+atomic<slab_node*>
+slab_pool<Size, Alignment>::free_ = ATOMIC_VAR_INIT(nullptr);
+
+}   /* slab_detail */
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Stateless allocator using a per-type slab for single objects.
+ */
+template <typename T>
+class slab_allocator
+{
+public:
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using propagate_on_container_copy_assignment = true_type;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+    using is_always_equal = true_type;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    slab_allocator() noexcept = default;
+    slab_allocator(const slab_allocator&) noexcept = default;
+    slab_allocator& operator=(const slab_allocator&) noexcept = default;
+
+    template <typename U>
+    slab_allocator(
+        const slab_allocator<U>&
+    )
+    noexcept
+    {}
+
+    value_type*
+    allocate(
+        size_type n
+    )
+    {
+        if (n == 1) {
+            return static_cast<value_type*>(pool_type::allocate());
+        }
+        if (n > size_type(-1) / sizeof(value_type)) {
+            throw bad_alloc();
+        }
+        return static_cast<value_type*>(::operator new(n * sizeof(value_type)));
+    }
+
+    void
+    deallocate(
+        value_type* p,
+        size_type n
+    )
+    noexcept
+    {
+        if (n == 1) {
+            pool_type::deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    using pool_type = slab_detail::slab_pool<sizeof(T), alignof(T)>;
+};
+
+
+template <typename T, typename U>
+inline
+bool
+operator==(
+    const slab_allocator<T>&,
+    const slab_allocator<U>&
+)
+noexcept
+{
+    return true;
+}
+
+
+template <typename T, typename U>
+inline
+bool
+operator!=(
+    const slab_allocator<T>&,
+    const slab_allocator<U>&
+)
+noexcept
+{
+    return false;
+}
+
+PYCPP_END_NAMESPACE
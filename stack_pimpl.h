@@ -16,6 +16,30 @@
  *  behavior, the destructor includes a static assert to ensure
  *  the alignment and type-size are compatible.
  *
+ *  With the `storage_padded` policy, the buffer may be larger than
+ *  the type, and `padded_stack_pimpl` defaults the alignment to
+ *  `cache_line_size`, so adjacent objects, for example, in per-thread
+ *  arrays, never share a cache line. Allocating over-aligned types
+ *  on the heap requires C++17 aligned `operator new`.
+ *
+ *  The exact size and alignment of each implied class may be generated
+ *  for the target platform at configure time, with the `pimpl_sizes`
+ *  CMake function from `pimpl_sizes.cmake`. When
+ *  `USE_PIMPL_SIZE_DIAGNOSTICS` is defined, every storage larger than
+ *  the type, including the padding added by a stricter alignment,
+ *  emits a deprecation warning naming the type and the wasted bytes.
+ *  Padded storage always reports its padding.
+ *
+ *  Copies, moves and swaps are `noexcept` whenever the corresponding
+ *  operations of the implied class are, evaluated when they are first
+ *  used, once the type is complete. So containers move, rather than
+ *  copy, the wrapper on growth. Triviality must be known when the
+ *  wrapper is declared, and the implied class may still be incomplete,
+ *  so it is opt-in: specializing `is_trivial_pimpl` for a trivially
+ *  copyable and destructible type makes `stack_pimpl` trivially
+ *  copyable and destructible as well, like a bare `T`, which is
+ *  statically checked once the type is constructed.
+ *
  *  The class should be used as a private member variable encapsulating
  *  the implied class in the public class. For example:
  *
@@ -41,16 +65,29 @@
  *      https://whereswalden.com/tag/stdaligned_storage/
  *
  *  \synopsis
+ *      constexpr size_t cache_line_size = implementation-defined;
+ *
+ *      enum storage_policy
+ *      {
+ *          storage_exact,
+ *          storage_padded,
+ *      };
+ *
+ *      template <typename T>
+ *      struct is_trivial_pimpl;
+ *
  *      template <
  *          typename T,
  *          size_t Size = sizeof(T),
- *          size_t Alignment = alignof(max_align_t)
+ *          size_t Alignment = alignof(max_align_t),
+ *          storage_policy Policy = storage_exact
  *      >
  *      class stack_pimpl
  *      {
  *      public:
  *          static constexpr size_t size = Size;
  *          static constexpr size_t alignment = Alignment;
+ *          static constexpr storage_policy policy = Policy;
  *
  *          using value_type = T;
  *          using reference = T&;
@@ -58,15 +95,15 @@
  *          using pointer = T*;
  *          using const_pointer = const T*;
  *
- *          stack_pimpl();
- *          stack_pimpl(const stack_pimpl& x);
- *          stack_pimpl& operator=(const stack_pimpl& x);
- *          stack_pimpl(stack_pimpl&& x);
- *          stack_pimpl& operator=(stack_pimpl&& x);
- *          stack_pimpl(const value_type& x);
- *          stack_pimpl& operator=(const value_type& x);
- *          stack_pimpl(value_type&& x);
- *          stack_pimpl& operator=(value_type&& x);
+ *          stack_pimpl() noexcept(see below);
+ *          stack_pimpl(const stack_pimpl& x) noexcept(see below);
+ *          stack_pimpl& operator=(const stack_pimpl& x) noexcept(see below);
+ *          stack_pimpl(stack_pimpl&& x) noexcept(see below);
+ *          stack_pimpl& operator=(stack_pimpl&& x) noexcept(see below);
+ *          stack_pimpl(const value_type& x) noexcept(see below);
+ *          stack_pimpl& operator=(const value_type& x) noexcept(see below);
+ *          stack_pimpl(value_type&& x) noexcept(see below);
+ *          stack_pimpl& operator=(value_type&& x) noexcept(see below);
  *          ~stack_pimpl();
  *
  *          reference operator*() noexcept;
@@ -78,18 +115,61 @@
  *          reference get() noexcept;
  *          const_reference get() const noexcept;
  *
- *          void swap(stack_pimpl& x);
+ *          void swap(stack_pimpl& x) noexcept(see below);
  *      };
+ *
+ *      template <typename T, size_t Size, size_t Alignment = cache_line_size>
+ *      using padded_stack_pimpl = stack_pimpl<T, Size, Alignment, storage_padded>;
+ *
+ *      template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+ *      struct is_relocatable<stack_pimpl<T, Size, Alignment, Policy>>;
  */
 
 #pragma once
 
+#include <pycpp/adaptor/relocate.h>
 #include <pycpp/stl/cstddef.h>
 #include <pycpp/stl/type_traits.h>
 #include <pycpp/stl/utility.h>
 
 PYCPP_BEGIN_NAMESPACE
 
+// CONSTANTS
+// ---------
+
+/**
+ *  \brief Minimum offset between two objects to avoid false sharing.
+ *
+ *  Avoids `hardware_destructive_interference_size`, which is not
+ *  ABI-stable across compiler flags.
+ */
+#if defined(__powerpc64__) || (defined(__aarch64__) && defined(__APPLE__))
+constexpr size_t cache_line_size = 128;
+#else
+constexpr size_t cache_line_size = 64;
+#endif
+
+/**
+ *  \brief Whether the storage size must match the type size exactly.
+ */
+enum storage_policy
+{
+    storage_exact,
+    storage_padded,
+};
+
+// TRAITS
+// ------
+
+/**
+ *  \brief Opt-in trivial storage for a trivially copyable type.
+ *
+ *  Specialize as `true_type` before any use of the `stack_pimpl`.
+ */
+template <typename T>
+struct is_trivial_pimpl: false_type
+{};
+
 namespace pimp_detail
 {
 // DETAIL
@@ -98,81 +178,131 @@ namespace pimp_detail
 
 // Static check to ensure the type is properly sized and
 // aligned to avoid any undefined behavior. Ensure
-// the size is exactly equal, and that the alignment
-// is at least as strict as the type alignment.
+// the size is exactly equal, or at least as large with padded
+// storage, and that the alignment is at least as strict as the
+// type alignment.
 // Larger alignments are stricter on the memory locations
 // they can be placed, and any stricter alignment can
 // be used in place of a weaker one, according to the C standard.
 
+#if defined(USE_PIMPL_SIZE_DIAGNOSTICS)
+
+constexpr
+size_t
+round_storage(
+    size_t size,
+    size_t alignment
+)
+noexcept
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+
+// The deprecation warning reports the instantiation, with the
+// type, the size and alignment given, and the bytes wasted
+// beyond the size of the type rounded to its own alignment.
+template <typename T, size_t Size, size_t Alignment, size_t Wasted>
+struct storage_report
+{
+#if defined(_MSC_VER)
+    __declspec(deprecated("stack_pimpl storage wastes bytes, see `Wasted`."))
+#else
+    __attribute__((deprecated("stack_pimpl storage wastes bytes, see `Wasted`.")))
+#endif
+    static
+    void
+    wasted()
+    noexcept
+    {}
+};
+
+
 template <typename T, size_t Size, size_t Alignment>
+struct storage_report<T, Size, Alignment, 0>
+{
+    static
+    void
+    wasted()
+    noexcept
+    {}
+};
+
+#endif                                          // USE_PIMPL_SIZE_DIAGNOSTICS
+
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy = storage_exact>
 inline
 void
 assert_storage()
 noexcept
 {
-    static_assert(sizeof(T) == Size, "");
+    static_assert(Policy == storage_padded ? sizeof(T) <= Size : sizeof(T) == Size, "");
     static_assert(alignof(T) <= Alignment, "");
+#if defined(USE_PIMPL_SIZE_DIAGNOSTICS)
+    storage_report<
+        T, Size, Alignment,
+        round_storage(Size, Alignment) - sizeof(T)
+    >::wasted();
+#endif
 }
 
 
-template <typename T, size_t Size, size_t Alignment>
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy = storage_exact>
 struct storage_asserter
 {
     inline
     storage_asserter()
     noexcept
     {
-        assert_storage<T, Size, Alignment>();
+        assert_storage<T, Size, Alignment, Policy>();
     }
 };
 
-}   /* pimp_detail */
 
-// DECLARATION
-// -----------
+struct construct_t
+{};
+
 
 /**
- *  \brief PIMPL idiom using aligned storage to avoid dynamic allocation.
+ *  \brief Storage owning the implied member, with copy, move and
+ *  destruction conditionally `noexcept` on the implied class.
+ *
+ *  The member is constructed by the storage constructor, so the
+ *  storage is never destroyed if the construction throws.
  */
 template <
     typename T,
-    size_t Size = sizeof(T),
-    size_t Alignment = alignof(max_align_t)
+    size_t Size,
+    size_t Alignment,
+    storage_policy Policy,
+    bool = is_trivial_pimpl<T>::value
 >
-class stack_pimpl
+class stack_storage
 {
 public:
-    // MEMBER VARIABLES
-    // ----------------
-    static constexpr size_t size = Size;
-    static constexpr size_t alignment = Alignment;
-
-    // MEMBER TYPES
-    // ------------
-    using value_type = T;
-    using reference = T&;
-    using const_reference = const T&;
-    using pointer = T*;
-    using const_pointer = const T*;
-
-    // MEMBER FUNCTIONS
-    // ----------------
-    stack_pimpl()
+    template <typename ... Ts>
+    stack_storage(
+        construct_t,
+        Ts&&... ts
+    )
+    noexcept(is_nothrow_constructible<T, Ts...>::value)
     {
-        new (&get()) value_type();
+        new (&get()) T(forward<Ts>(ts)...);
     }
 
-    stack_pimpl(
-        const stack_pimpl& x
+    stack_storage(
+        const stack_storage& x
     )
+    noexcept(is_nothrow_copy_constructible<T>::value)
     {
-        new (&get()) value_type(x.get());
+        new (&get()) T(x.get());
     }
 
-    stack_pimpl&
+    stack_storage&
     operator=(
-        const stack_pimpl& x
+        const stack_storage& x
     )
+    noexcept(is_nothrow_copy_assignable<T>::value)
     {
         if (this != &x) {
             get() = x.get();
@@ -180,17 +310,19 @@ public:
         return *this;
     }
 
-    stack_pimpl(
-        stack_pimpl&& x
+    stack_storage(
+        stack_storage&& x
     )
+    noexcept(is_nothrow_move_constructible<T>::value)
     {
-        new (&get()) value_type(move(x.get()));
+        new (&get()) T(move(x.get()));
     }
 
-    stack_pimpl&
+    stack_storage&
     operator=(
-        stack_pimpl&& x
+        stack_storage&& x
     )
+    noexcept(is_nothrow_move_assignable<T>::value)
     {
         if (this != &x) {
             get() = move(x.get());
@@ -198,17 +330,138 @@ public:
         return *this;
     }
 
-    stack_pimpl(
-        const value_type& x
+    ~stack_storage()
+    {
+        storage_asserter<T, Size, Alignment, Policy> {};
+        get().~T();
+    }
+
+    T&
+    get()
+    noexcept
+    {
+        return reinterpret_cast<T&>(mem_);
+    }
+
+    const T&
+    get()
+    const noexcept
+    {
+        return reinterpret_cast<const T&>(mem_);
+    }
+
+private:
+    using memory_type = aligned_storage_t<Size, Alignment>;
+    memory_type mem_;
+};
+
+
+/**
+ *  \brief Trivially copyable and destructible storage.
+ *
+ *  Without a destructor to hold the static checks, the constructor
+ *  checks both the storage and the triviality of the type.
+ */
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+class stack_storage<T, Size, Alignment, Policy, true>
+{
+public:
+    template <typename ... Ts>
+    stack_storage(
+        construct_t,
+        Ts&&... ts
     )
+    noexcept(is_nothrow_constructible<T, Ts...>::value)
     {
-        new (&get()) value_type(x);
+        static_assert(is_trivially_copyable<T>::value, "Trivial pimpl type must be trivially copyable.");
+        static_assert(is_trivially_destructible<T>::value, "Trivial pimpl type must be trivially destructible.");
+        storage_asserter<T, Size, Alignment, Policy> {};
+        new (&get()) T(forward<Ts>(ts)...);
     }
 
+    stack_storage(const stack_storage&) = default;
+    stack_storage& operator=(const stack_storage&) = default;
+    stack_storage(stack_storage&&) = default;
+    stack_storage& operator=(stack_storage&&) = default;
+    ~stack_storage() = default;
+
+    T&
+    get()
+    noexcept
+    {
+        return reinterpret_cast<T&>(mem_);
+    }
+
+    const T&
+    get()
+    const noexcept
+    {
+        return reinterpret_cast<const T&>(mem_);
+    }
+
+private:
+    using memory_type = aligned_storage_t<Size, Alignment>;
+    memory_type mem_;
+};
+
+}   /* pimp_detail */
+
+// DECLARATION
+// -----------
+
+/**
+ *  \brief PIMPL idiom using aligned storage to avoid dynamic allocation.
+ */
+template <
+    typename T,
+    size_t Size = sizeof(T),
+    size_t Alignment = alignof(max_align_t),
+    storage_policy Policy = storage_exact
+>
+class stack_pimpl:
+    private pimp_detail::stack_storage<T, Size, Alignment, Policy>
+{
+    using base = pimp_detail::stack_storage<T, Size, Alignment, Policy>;
+
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t size = Size;
+    static constexpr size_t alignment = Alignment;
+    static constexpr storage_policy policy = Policy;
+
+    // MEMBER TYPES
+    // ------------
+    using value_type = T;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    stack_pimpl()
+    noexcept(is_nothrow_default_constructible<T>::value):
+        base(pimp_detail::construct_t())
+    {}
+
+    stack_pimpl(const stack_pimpl&) = default;
+    stack_pimpl& operator=(const stack_pimpl&) = default;
+    stack_pimpl(stack_pimpl&&) = default;
+    stack_pimpl& operator=(stack_pimpl&&) = default;
+
+    stack_pimpl(
+        const value_type& x
+    )
+    noexcept(is_nothrow_copy_constructible<T>::value):
+        base(pimp_detail::construct_t(), x)
+    {}
+
     stack_pimpl&
     operator=(
         const value_type& x
     )
+    noexcept(is_nothrow_copy_assignable<T>::value)
     {
         get() = x;
         return *this;
@@ -217,24 +470,21 @@ public:
     stack_pimpl(
         value_type&& x
     )
-    {
-        new (&get()) value_type(move(x));
-    }
+    noexcept(is_nothrow_move_constructible<T>::value):
+        base(pimp_detail::construct_t(), move(x))
+    {}
 
     stack_pimpl&
     operator=(
         value_type&& x
     )
+    noexcept(is_nothrow_move_assignable<T>::value)
     {
         get() = move(x);
         return *this;
     }
 
-    ~stack_pimpl()
-    {
-        pimp_detail::storage_asserter<T, Size, Alignment> {};
-        get().~T();
-    }
+    ~stack_pimpl() = default;
 
     // CONVERSIONS
     reference
@@ -283,14 +533,14 @@ public:
     get()
     noexcept
     {
-        return reinterpret_cast<reference>(mem_);
+        return base::get();
     }
 
     const_reference
     get()
     const noexcept
     {
-        return reinterpret_cast<const_reference>(mem_);
+        return base::get();
     }
 
     // MODIFIERS
@@ -298,29 +548,35 @@ public:
     swap(
         stack_pimpl& x
     )
+    noexcept(is_nothrow_move_constructible<T>::value && is_nothrow_move_assignable<T>::value)
     {
         fast_swap(get(), x.get());
     }
-
-private:
-    using memory_type = aligned_storage_t<Size, Alignment>;
-    memory_type mem_;
 };
 
+// ALIAS
+// -----
+
+template <typename T, size_t Size, size_t Alignment = cache_line_size>
+using padded_stack_pimpl = stack_pimpl<T, Size, Alignment, storage_padded>;
+
 // SPECIALIZATION
 // --------------
 
-template <typename T, size_t Size, size_t Alignment>
-struct is_relocatable<stack_pimpl<T, Size, Alignment>>: is_relocatable<T>
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+struct is_relocatable<stack_pimpl<T, Size, Alignment, Policy>>: is_relocatable<T>
 {};
 
 // IMPLEMENTATION
 // --------------
 
-template <typename T, size_t Size, size_t Alignment>
-const size_t stack_pimpl<T, Size, Alignment>::size;
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+const size_t stack_pimpl<T, Size, Alignment, Policy>::size;
 
-template <typename T, size_t Size, size_t Alignment>
-const size_t stack_pimpl<T, Size, Alignment>::alignment;
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+const size_t stack_pimpl<T, Size, Alignment, Policy>::alignment;
+
+template <typename T, size_t Size, size_t Alignment, storage_policy Policy>
+const storage_policy stack_pimpl<T, Size, Alignment, Policy>::policy;
 
 PYCPP_END_NAMESPACE
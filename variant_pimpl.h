@@ -0,0 +1,591 @@
+//  :copyright: (c) 2017-2018 Alex Huszagh.
+//  :license: MIT, see licenses/mit.md for more details.
+/**
+ *  \addtogroup PyCPP
+ *  \brief Fast PIMPL idiom over a closed set of implied classes.
+ *
+ *  Stores one of several implied classes inline, in a buffer sized
+ *  and aligned for the largest, like `stack_pimpl`, and dispatches
+ *  calls through a jump table indexed by the active alternative.
+ *  Compared to a `unique_heap_pimpl` over an abstract base, this
+ *  removes both the heap indirection and the vtable load, and each
+ *  alternative is called directly, so it may be inlined into the
+ *  jump table entry.
+ *
+ *  The alternative is chosen either by type, or by an index computed
+ *  at runtime, for example, from the CPU features detected once at
+ *  construction. The alternatives **must** be nothrow move
+ *  constructible, so assignment never leaves the wrapper empty.
+ *
+ *  `basic_variant_pimpl` takes the size and alignment explicitly, so
+ *  the alternatives may be incomplete where the public class is
+ *  defined, and checks the storage in the destructor, as with
+ *  `stack_pimpl`. `variant_pimpl` derives them from the alternatives.
+ *
+ *  \code
+ *      #include <pycpp/adaptor/variant_pimpl.h>
+ *
+ *      struct avx2_codec;
+ *      struct scalar_codec;
+ *      struct codec
+ *      {
+ *      public:
+ *          codec();
+ *          size_t encode(const char* src, size_t n, char* dst);
+ *      private:
+ *          basic_variant_pimpl<64, 32, avx2_codec, scalar_codec> impl_;
+ *      };
+ *
+ *      // codec.cpp
+ *      codec::codec():
+ *          impl_(select_impl_t(), has_avx2() ? 0 : 1)
+ *      {}
+ *
+ *      size_t codec::encode(const char* src, size_t n, char* dst)
+ *      {
+ *          return impl_.visit([&](auto& c) { return c.encode(src, n, dst); });
+ *      }
+ *
+ *  \synopsis
+ *      template <typename T>
+ *      struct in_place_impl_t {};
+ *
+ *      struct select_impl_t {};
+ *
+ *      template <size_t Size, size_t Alignment, typename ... Ts>
+ *      class basic_variant_pimpl
+ *      {
+ *      public:
+ *          static constexpr size_t size = Size;
+ *          static constexpr size_t alignment = Alignment;
+ *          static constexpr size_t alternatives = sizeof...(Ts);
+ *
+ *          basic_variant_pimpl();
+ *          template <typename T, typename ... Args>
+ *          basic_variant_pimpl(in_place_impl_t<T>, Args&&... args);
+ *          template <typename ... Args>
+ *          basic_variant_pimpl(select_impl_t, size_t index, Args&&... args);
+ *          basic_variant_pimpl(const basic_variant_pimpl& x);
+ *          basic_variant_pimpl& operator=(const basic_variant_pimpl& x);
+ *          basic_variant_pimpl(basic_variant_pimpl&& x) noexcept;
+ *          basic_variant_pimpl& operator=(basic_variant_pimpl&& x) noexcept;
+ *          ~basic_variant_pimpl();
+ *
+ *          size_t index() const noexcept;
+ *          template <typename T> bool holds() const noexcept;
+ *          template <typename T> T& get() noexcept;
+ *          template <typename T> const T& get() const noexcept;
+ *          template <typename T> T* get_if() noexcept;
+ *          template <typename T> const T* get_if() const noexcept;
+ *
+ *          template <typename Function> auto visit(Function&& f);
+ *          template <typename Function> auto visit(Function&& f) const;
+ *
+ *          template <typename T, typename ... Args>
+ *          T& emplace(Args&&... args);
+ *          void swap(basic_variant_pimpl& x) noexcept;
+ *      };
+ *
+ *      template <typename ... Ts>
+ *      using variant_pimpl = basic_variant_pimpl<implementation-defined, implementation-defined, Ts...>;
+ *
+ *      template <size_t Size, size_t Alignment, typename ... Ts>
+ *      struct is_relocatable<basic_variant_pimpl<Size, Alignment, Ts...>>;
+ */
+
+#pragma once
+
+#include <pycpp/adaptor/relocate.h>
+#include <pycpp/stl/cassert.h>
+#include <pycpp/stl/cstddef.h>
+#include <pycpp/stl/new.h>
+#include <pycpp/stl/type_traits.h>
+#include <pycpp/stl/utility.h>
+
+PYCPP_BEGIN_NAMESPACE
+
+// OBJECTS
+// -------
+
+/**
+ *  \brief Tag to construct a specific alternative.
+ */
+template <typename T>
+struct in_place_impl_t
+{};
+
+
+/**
+ *  \brief Tag to construct the alternative at a runtime index.
+ */
+struct select_impl_t
+{};
+
+namespace variant_detail
+{
+// DETAIL
+// ------
+
+template <typename ... Ts>
+struct max_size;
+
+template <>
+struct max_size<>: integral_constant<size_t, 1>
+{};
+
+template <typename T, typename ... Ts>
+struct max_size<T, Ts...>: integral_constant<size_t,
+    (sizeof(T) > max_size<Ts...>::value ? sizeof(T) : max_size<Ts...>::value)
+>
+{};
+
+
+template <typename ... Ts>
+struct max_alignment;
+
+template <>
+struct max_alignment<>: integral_constant<size_t, 1>
+{};
+
+template <typename T, typename ... Ts>
+struct max_alignment<T, Ts...>: integral_constant<size_t,
+    (alignof(T) > max_alignment<Ts...>::value ? alignof(T) : max_alignment<Ts...>::value)
+>
+{};
+
+
+// Index of `T` in `Ts`, or `sizeof...(Ts)` if absent.
+template <typename T, typename ... Ts>
+struct index_of;
+
+template <typename T>
+struct index_of<T>: integral_constant<size_t, 0>
+{};
+
+template <typename T, typename ... Ts>
+struct index_of<T, T, Ts...>: integral_constant<size_t, 0>
+{};
+
+template <typename T, typename U, typename ... Ts>
+struct index_of<T, U, Ts...>: integral_constant<size_t, 1 + index_of<T, Ts...>::value>
+{};
+
+
+template <typename ... Ts>
+struct all_relocatable;
+
+template <>
+struct all_relocatable<>: true_type
+{};
+
+template <typename T, typename ... Ts>
+struct all_relocatable<T, Ts...>: integral_constant<bool,
+    is_relocatable<T>::value && all_relocatable<Ts...>::value
+>
+{};
+
+
+template <typename ... Ts>
+struct all_nothrow_movable;
+
+template <>
+struct all_nothrow_movable<>: true_type
+{};
+
+template <typename T, typename ... Ts>
+struct all_nothrow_movable<T, Ts...>: integral_constant<bool,
+    is_nothrow_move_constructible<T>::value && all_nothrow_movable<Ts...>::value
+>
+{};
+
+
+template <typename T, typename ... Ts>
+struct first_type
+{
+    using type = T;
+};
+
+
+template <size_t Size, size_t Alignment, typename ... Ts>
+struct storage_fits;
+
+template <size_t Size, size_t Alignment>
+struct storage_fits<Size, Alignment>: true_type
+{};
+
+template <size_t Size, size_t Alignment, typename T, typename ... Ts>
+struct storage_fits<Size, Alignment, T, Ts...>: integral_constant<bool,
+    sizeof(T) <= Size && alignof(T) <= Alignment && storage_fits<Size, Alignment, Ts...>::value
+>
+{};
+
+// JUMP TABLE ENTRIES
+
+template <typename T>
+void
+destroy(
+    void* p
+)
+noexcept
+{
+    static_cast<T*>(p)->~T();
+}
+
+
+template <typename T>
+void
+copy_construct(
+    void* dst,
+    const void* src
+)
+{
+    ::new (dst) T(*static_cast<const T*>(src));
+}
+
+
+template <typename T>
+void
+copy_assign(
+    void* dst,
+    const void* src
+)
+{
+    *static_cast<T*>(dst) = *static_cast<const T*>(src);
+}
+
+
+template <typename T>
+void
+move_construct(
+    void* dst,
+    void* src
+)
+noexcept
+{
+    ::new (dst) T(move(*static_cast<T*>(src)));
+}
+
+
+template <typename T, typename ... Args>
+void
+construct(
+    void* dst,
+    Args&&... args
+)
+{
+    ::new (dst) T(forward<Args>(args)...);
+}
+
+
+// `T` is const-qualified for const visitation.
+template <typename Result, typename T, typename Function>
+Result
+invoke(
+    Function& f,
+    const void* p
+)
+{
+    return f(*static_cast<T*>(const_cast<void*>(p)));
+}
+
+}   /* variant_detail */
+
+/**
+ *  \brief PIMPL idiom over inline storage for any of `Ts`.
+ */
+template <size_t Size, size_t Alignment, typename ... Ts>
+class basic_variant_pimpl
+{
+    static_assert(sizeof...(Ts) > 0, "Variant PIMPL requires at least one alternative.");
+    static_assert(sizeof...(Ts) < 256, "Too many alternatives.");
+
+    using first_type = typename variant_detail::first_type<Ts...>::type;
+
+    template <typename T>
+    using index_of = variant_detail::index_of<T, Ts...>;
+
+public:
+    // MEMBER VARIABLES
+    // ----------------
+    static constexpr size_t size = Size;
+    static constexpr size_t alignment = Alignment;
+    static constexpr size_t alternatives = sizeof...(Ts);
+
+    // MEMBER FUNCTIONS
+    // ----------------
+    basic_variant_pimpl():
+        index_(0)
+    {
+        ::new (static_cast<void*>(&mem_)) first_type();
+    }
+
+    template <typename T, typename ... Args>
+    basic_variant_pimpl(
+        in_place_impl_t<T>,
+        Args&&... args
+    ):
+        index_(static_cast<unsigned char>(index_of<T>::value))
+    {
+        static_assert(index_of<T>::value < sizeof...(Ts), "Type is not an alternative.");
+        ::new (static_cast<void*>(&mem_)) T(forward<Args>(args)...);
+    }
+
+    // Every alternative must be constructible from `args`.
+    template <typename ... Args>
+    basic_variant_pimpl(
+        select_impl_t,
+        size_t index,
+        Args&&... args
+    ):
+        index_(static_cast<unsigned char>(index))
+    {
+        using function = void (*)(void*, Args&&...);
+        static constexpr function table[] = {&variant_detail::construct<Ts, Args...>...};
+        assert(index < sizeof...(Ts) && "Alternative index out of range.");
+        table[index](&mem_, forward<Args>(args)...);
+    }
+
+    basic_variant_pimpl(
+        const basic_variant_pimpl& x
+    ):
+        index_(x.index_)
+    {
+        using function = void (*)(void*, const void*);
+        static constexpr function table[] = {&variant_detail::copy_construct<Ts>...};
+        table[index_](&mem_, &x.mem_);
+    }
+
+    basic_variant_pimpl&
+    operator=(
+        const basic_variant_pimpl& x
+    )
+    {
+        if (this == &x) {
+            return *this;
+        } else if (index_ == x.index_) {
+            using function = void (*)(void*, const void*);
+            static constexpr function table[] = {&variant_detail::copy_assign<Ts>...};
+            table[index_](&mem_, &x.mem_);
+        } else {
+            // copy first, so a throwing copy leaves `*this` unchanged
+            *this = basic_variant_pimpl(x);
+        }
+        return *this;
+    }
+
+    basic_variant_pimpl(
+        basic_variant_pimpl&& x
+    )
+    noexcept:
+        index_(x.index_)
+    {
+        move_from(x);
+    }
+
+    basic_variant_pimpl&
+    operator=(
+        basic_variant_pimpl&& x
+    )
+    noexcept
+    {
+        if (this != &x) {
+            destroy();
+            index_ = x.index_;
+            move_from(x);
+        }
+        return *this;
+    }
+
+    ~basic_variant_pimpl()
+    {
+        static_assert(variant_detail::storage_fits<Size, Alignment, Ts...>::value, "");
+        static_assert(variant_detail::all_nothrow_movable<Ts...>::value, "Alternatives must be nothrow move constructible.");
+        destroy();
+    }
+
+    // OBSERVERS
+    size_t
+    index()
+    const noexcept
+    {
+        return index_;
+    }
+
+    template <typename T>
+    bool
+    holds()
+    const noexcept
+    {
+        static_assert(index_of<T>::value < sizeof...(Ts), "Type is not an alternative.");
+        return index_ == index_of<T>::value;
+    }
+
+    template <typename T>
+    T&
+    get()
+    noexcept
+    {
+        assert(holds<T>() && "Alternative is not active.");
+        return reinterpret_cast<T&>(mem_);
+    }
+
+    template <typename T>
+    const T&
+    get()
+    const noexcept
+    {
+        assert(holds<T>() && "Alternative is not active.");
+        return reinterpret_cast<const T&>(mem_);
+    }
+
+    template <typename T>
+    T*
+    get_if()
+    noexcept
+    {
+        return holds<T>() ? &reinterpret_cast<T&>(mem_) : nullptr;
+    }
+
+    template <typename T>
+    const T*
+    get_if()
+    const noexcept
+    {
+        return holds<T>() ? &reinterpret_cast<const T&>(mem_) : nullptr;
+    }
+
+    // Call `f` with the active alternative. Every overload must return
+    // the same type.
+    template <typename Function>
+    auto
+    visit(
+        Function&& f
+    )
+    -> decltype(f(declval<first_type&>()))
+    {
+        using result = decltype(f(declval<first_type&>()));
+        using function = result (*)(Function&, const void*);
+        static constexpr function table[] = {&variant_detail::invoke<result, Ts, Function>...};
+        return table[index_](f, &mem_);
+    }
+
+    template <typename Function>
+    auto
+    visit(
+        Function&& f
+    )
+    const
+    -> decltype(f(declval<const first_type&>()))
+    {
+        using result = decltype(f(declval<const first_type&>()));
+        using function = result (*)(Function&, const void*);
+        static constexpr function table[] = {&variant_detail::invoke<result, const Ts, Function>...};
+        return table[index_](f, &mem_);
+    }
+
+    // MODIFIERS
+    template <typename T, typename ... Args>
+    T&
+    emplace(
+        Args&&... args
+    )
+    {
+        static_assert(index_of<T>::value < sizeof...(Ts), "Type is not an alternative.");
+        emplace_impl<T>(is_nothrow_constructible<T, Args...>(), forward<Args>(args)...);
+        index_ = static_cast<unsigned char>(index_of<T>::value);
+        return reinterpret_cast<T&>(mem_);
+    }
+
+    void
+    swap(
+        basic_variant_pimpl& x
+    )
+    noexcept
+    {
+        basic_variant_pimpl tmp(move(x));
+        x = move(*this);
+        *this = move(tmp);
+    }
+
+private:
+    using memory_type = aligned_storage_t<Size, Alignment>;
+    memory_type mem_;
+    unsigned char index_;
+
+    void
+    destroy()
+    noexcept
+    {
+        using function = void (*)(void*);
+        static constexpr function table[] = {&variant_detail::destroy<Ts>...};
+        table[index_](&mem_);
+    }
+
+    void
+    move_from(
+        basic_variant_pimpl& x
+    )
+    noexcept
+    {
+        using function = void (*)(void*, void*);
+        static constexpr function table[] = {&variant_detail::move_construct<Ts>...};
+        table[index_](&mem_, &x.mem_);
+    }
+
+    template <typename T, typename ... Args>
+    void
+    emplace_impl(
+        true_type,
+        Args&&... args
+    )
+    noexcept
+    {
+        destroy();
+        ::new (static_cast<void*>(&mem_)) T(forward<Args>(args)...);
+    }
+
+    // construct a temporary, so a throwing constructor leaves
+    // the active alternative unchanged
+    template <typename T, typename ... Args>
+    void
+    emplace_impl(
+        false_type,
+        Args&&... args
+    )
+    {
+        T tmp(forward<Args>(args)...);
+        destroy();
+        ::new (static_cast<void*>(&mem_)) T(move(tmp));
+    }
+};
+
+// ALIAS
+// -----
+
+template <typename ... Ts>
+using variant_pimpl = basic_variant_pimpl<
+    variant_detail::max_size<Ts...>::value,
+    variant_detail::max_alignment<Ts...>::value,
+    Ts...
+>;
+
+// SPECIALIZATION
+// --------------
+
+template <size_t Size, size_t Alignment, typename ... Ts>
+struct is_relocatable<basic_variant_pimpl<Size, Alignment, Ts...>>: variant_detail::all_relocatable<Ts...>
+{};
+
+// IMPLEMENTATION
+// --------------
+
+template <size_t Size, size_t Alignment, typename ... Ts>
+const size_t basic_variant_pimpl<Size, Alignment, Ts...>::size;
+
+template <size_t Size, size_t Alignment, typename ... Ts>
+const size_t basic_variant_pimpl<Size, Alignment, Ts...>::alignment;
+
+template <size_t Size, size_t Alignment, typename ... Ts>
+const size_t basic_variant_pimpl<Size, Alignment, Ts...>::alternatives;
+
+PYCPP_END_NAMESPACE